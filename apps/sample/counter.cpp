@@ -3,7 +3,7 @@
 #include <cstdlib>
 #include <iostream>
 
-#include <tasvir/tasvir.h>
+#include <tasvir/area.hpp>
 
 int main(int argc, char **argv) {
     constexpr int KB = 1024;
@@ -32,21 +32,21 @@ int main(int argc, char **argv) {
               << " sync_int_us=" << sync_int_us << " sync_ext_us=" << sync_ext_us << std::endl;
 
     tasvir_area_desc param = {};
-    param.len = 1 * KB;
     param.sync_int_us = sync_int_us;
     param.sync_ext_us = sync_ext_us;
 
-    int *counter[nr_workers_max];
+    tasvir::Area<int> counter[nr_workers_max];
 
     for (int wid = 0; wid < nr_workers; wid++) {
-        snprintf(param.name, sizeof(param.name), "counter-%04x", wid);
-        tasvir_area_desc *d = my_wid == wid ? tasvir_new(param) : tasvir_attach_wait(5 * S2US, param.name);
-        if (!d) {
-            std::cerr << "creation/attach to " << param.name << " failed" << std::endl;
+        char name[32];
+        snprintf(name, sizeof(name), "counter-%04x", wid);
+        counter[wid] = my_wid == wid ? tasvir::Area<int>::Create(name, KB / sizeof(int), param)
+                                     : tasvir::Area<int>::Attach(name, 5 * S2US);
+        if (!counter[wid]) {
+            std::cerr << "creation/attach to " << name << " failed" << std::endl;
             return -1;
         }
-        counter[wid] = (int *)tasvir_data(d);
-        std::cout << "worker " << wid << " counter @" << counter[wid] << std::endl;
+        std::cout << "worker " << wid << " counter @" << counter[wid].data() << std::endl;
     }
 
     // doing two repetitions to start the timer at the same time for all processes
@@ -55,9 +55,8 @@ int main(int argc, char **argv) {
         auto start = std::chrono::steady_clock::now();
         for (int count = 1 + rep; count <= count_to2 + rep; count++) {
             *counter[my_wid] = count;
-            tasvir_log(counter[my_wid], sizeof(int));
             for (int wid = 0; wid < nr_workers; wid++)
-                while (*counter[wid] < count)
+                while (*counter[wid].data() < count)
                     tasvir_service();
             // Every thread is at step count
         }
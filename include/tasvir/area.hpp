@@ -0,0 +1,264 @@
+#ifndef __TASVIR_AREA__
+#define __TASVIR_AREA__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <type_traits>
+#include <utility>
+
+#include <tasvir/tasvir.h>
+
+namespace tasvir {
+
+/* types stored in an area are copied byte-wise across processes and nodes */
+template <typename T>
+struct is_area_type
+    : std::integral_constant<bool, std::is_trivially_copyable<T>::value && alignof(T) <= TASVIR_CACHELINE_BYTES> {};
+
+/* Collects the ranges written in a scope and logs them as merged runs when the scope ends.
+ * Tracked/Span writes go to the innermost Writer of the thread, or straight to tasvir_log when there is none.
+ * Do not call tasvir_service() inside a Writer scope: the pending ranges would miss that sync.
+ */
+class Writer {
+   public:
+    Writer() : _prev(Current()) { Current() = this; }
+    ~Writer() {
+        Flush();
+        Current() = _prev;
+    }
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    void Log(const void* data, std::size_t len) {
+        if (!len)
+            return;
+        /* runs keep the exact bytes written; tasvir_log rounds them to the log granularity of their area */
+        uintptr_t start = reinterpret_cast<uintptr_t>(data);
+        uintptr_t end = start + len;
+        /* newest runs first since writes tend to be sequential */
+        for (std::size_t i = _nr_runs; i-- > 0;) {
+            if (start <= _runs[i].end && end >= _runs[i].start) {
+                _runs[i].start = start < _runs[i].start ? start : _runs[i].start;
+                _runs[i].end = end > _runs[i].end ? end : _runs[i].end;
+                return;
+            }
+        }
+        if (_nr_runs == kMaxRuns)
+            Flush();
+        _runs[_nr_runs++] = {start, end};
+    }
+
+    /* log the pending runs now; sorting first merges runs that grew into each other */
+    void Flush() {
+        for (std::size_t i = 1; i < _nr_runs; i++) {
+            Run tmp = _runs[i];
+            std::size_t j = i;
+            for (; j > 0 && _runs[j - 1].start > tmp.start; j--)
+                _runs[j] = _runs[j - 1];
+            _runs[j] = tmp;
+        }
+        for (std::size_t i = 0; i < _nr_runs;) {
+            Run r = _runs[i];
+            for (i++; i < _nr_runs && _runs[i].start <= r.end; i++)
+                r.end = _runs[i].end > r.end ? _runs[i].end : r.end;
+            tasvir_log(reinterpret_cast<void*>(r.start), r.end - r.start);
+        }
+        _nr_runs = 0;
+    }
+
+    static void LogCurrent(const void* data, std::size_t len) {
+        if (Current())
+            Current()->Log(data, len);
+        else
+            tasvir_log(data, len);
+    }
+
+   private:
+    static constexpr std::size_t kMaxRuns = 32;
+    struct Run {
+        uintptr_t start;
+        uintptr_t end;
+    };
+
+    static Writer*& Current() {
+        static thread_local Writer* w = nullptr;
+        return w;
+    }
+
+    Run _runs[kMaxRuns];
+    std::size_t _nr_runs = 0;
+    Writer* _prev;
+};
+
+/* A reference to a T in an area; every mutation logs the bytes of the object. */
+template <typename T>
+class Tracked {
+    static_assert(is_area_type<T>::value, "T must be trivially copyable and at most cacheline aligned.");
+
+   public:
+    explicit Tracked(T* p) : _p(p) {}
+
+    const T& get() const { return *_p; }
+    operator const T&() const { return *_p; }
+    const T* operator->() const { return _p; }
+
+    Tracked& operator=(const T& v) {
+        *_p = v;
+        Log();
+        return *this;
+    }
+    Tracked& operator=(const Tracked& o) { return *this = o.get(); }
+
+    /* apply an arbitrary modification to the object in place */
+    template <typename F>
+    Tracked& Update(F&& f) {
+        f(*_p);
+        Log();
+        return *this;
+    }
+
+#define TASVIR_TRACKED_OP(op)              \
+    template <typename U>                  \
+    Tracked& operator op(const U& v) {     \
+        *_p op v;                          \
+        Log();                             \
+        return *this;                      \
+    }
+    TASVIR_TRACKED_OP(+=)
+    TASVIR_TRACKED_OP(-=)
+    TASVIR_TRACKED_OP(*=)
+    TASVIR_TRACKED_OP(/=)
+    TASVIR_TRACKED_OP(%=)
+    TASVIR_TRACKED_OP(&=)
+    TASVIR_TRACKED_OP(|=)
+    TASVIR_TRACKED_OP(^=)
+    TASVIR_TRACKED_OP(<<=)
+    TASVIR_TRACKED_OP(>>=)
+#undef TASVIR_TRACKED_OP
+
+    Tracked& operator++() { return Update([](T& v) { ++v; }); }
+    Tracked& operator--() { return Update([](T& v) { --v; }); }
+    T operator++(int) {
+        T old = *_p;
+        ++*this;
+        return old;
+    }
+    T operator--(int) {
+        T old = *_p;
+        --*this;
+        return old;
+    }
+
+   private:
+    void Log() { Writer::LogCurrent(_p, sizeof(T)); }
+
+    T* _p;
+};
+
+/* A contiguous run of T in an area; element writes log the element, bulk writes log the whole range once. */
+template <typename T>
+class Span {
+    static_assert(is_area_type<T>::value, "T must be trivially copyable and at most cacheline aligned.");
+
+   public:
+    typedef T value_type;
+    typedef std::size_t size_type;
+
+    Span(T* data, size_type size) : _data(data), _size(size) {}
+
+    size_type size() const { return _size; }
+    const T* data() const { return _data; }
+    const T* begin() const { return _data; }
+    const T* end() const { return _data + _size; }
+
+    const T& operator[](size_type i) const { return _data[i]; }
+    Tracked<T> operator[](size_type i) { return Tracked<T>(&_data[i]); }
+
+    Span subspan(size_type first, size_type count) { return Span(_data + first, count); }
+    Span<const T> subspan(size_type first, size_type count) const { return Span<const T>(_data + first, count); }
+
+    void Fill(const T& v) { Update([&](T& e) { e = v; }); }
+
+    void CopyFrom(const T* src, size_type count, size_type first = 0) {
+        std::copy(src, src + count, _data + first);
+        Writer::LogCurrent(_data + first, count * sizeof(T));
+    }
+
+    /* apply f to every element in place and log the span once */
+    template <typename F>
+    void Update(F&& f) {
+        for (size_type i = 0; i < _size; i++)
+            f(_data[i]);
+        Writer::LogCurrent(_data, _size * sizeof(T));
+    }
+
+   private:
+    T* _data;
+    size_type _size;
+};
+
+/* Handle to an area holding an array of T.
+ * Created areas are owned by the calling thread; attached areas are read-only views.
+ * The area outlives the handle since tasvir_detach and tasvir_delete are not supported yet.
+ */
+template <typename T>
+class Area {
+    static_assert(is_area_type<T>::value, "T must be trivially copyable and at most cacheline aligned.");
+
+   public:
+    Area() = default;
+    Area(const Area&) = delete;
+    Area& operator=(const Area&) = delete;
+    Area(Area&& o) : _d(o._d) { o._d = nullptr; }
+    Area& operator=(Area&& o) {
+        std::swap(_d, o._d);
+        return *this;
+    }
+
+    /* create an area named name with room for nr_elements of T; other fields of param are passed to tasvir_new */
+    static Area Create(const char* name, std::size_t nr_elements = 1, tasvir_area_desc param = {}) {
+        Area a;
+        snprintf(param.name, sizeof(param.name), "%s", name);
+        param.len = nr_elements * sizeof(T);
+        a._d = tasvir_new(param);
+        return a;
+    }
+
+    /* attach to the area named name, waiting up to timeout_us for it to appear */
+    static Area Attach(const char* name, uint64_t timeout_us = 0) {
+        Area a;
+        a._d = timeout_us ? tasvir_attach_wait(timeout_us, name) : tasvir_attach(name);
+        return a;
+    }
+
+    explicit operator bool() const { return _d; }
+    tasvir_area_desc* desc() const { return _d; }
+
+    /* version of the area in the view of this thread */
+    uint64_t version() const { return _d->h->version; }
+
+    /* sleep until the area reaches version; false on timeout */
+    bool WaitVersion(uint64_t version, uint64_t timeout_us) const {
+        return !tasvir_wait_version(_d, version, timeout_us);
+    }
+
+    /* number of T the area was created with */
+    std::size_t size() const { return _d->len_data / sizeof(T); }
+
+    const T* data() const { return reinterpret_cast<const T*>(tasvir_data(_d)); }
+    const T& operator[](std::size_t i) const { return data()[i]; }
+    Tracked<T> operator[](std::size_t i) { return Tracked<T>(mutable_data() + i); }
+    Tracked<T> operator*() { return Tracked<T>(mutable_data()); }
+    Span<T> span() { return Span<T>(mutable_data(), size()); }
+    Span<const T> span() const { return Span<const T>(data(), size()); }
+
+   private:
+    T* mutable_data() { return reinterpret_cast<T*>(tasvir_data(_d)); }
+
+    tasvir_area_desc* _d = nullptr;
+};
+
+}  // namespace tasvir
+#endif
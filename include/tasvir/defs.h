@@ -23,12 +23,20 @@
 #endif
 
 #define TASVIR_BARRIER_ENTER_US (50)     /**< Time (microseconds) to wait in the sync barrier */
+#define TASVIR_BARRIER_LEVELS (4)        /**< Levels of the sync barrier tree (core pairs, LLCs, sockets, node) */
 #define TASVIR_STAT_US (1 * 1000 * 1000) /**< Time (microseconds) between updating and printing average statistics */
+#define TASVIR_WAIT_SPIN_US (100)        /**< Longest time (microseconds) tasvir_wait_version spins before sleeping */
 #define TASVIR_SYNC_INTERNAL_US (100 * 1000)  /**< Time (microseconds) between internal synchronization intervals */
 #define TASVIR_SYNC_EXTERNAL_US (250 * 1000)  /**< Time (microseconds) between external synchronization intervals */
+#define TASVIR_SYNC_ADAPT_MIN_US (1000)       /**< Shortest sync interval (microseconds) picked for adaptive areas */
+#define TASVIR_SYNC_DIRTY_CHECK_US (1000)     /**< Time (microseconds) between checks of dirty byte thresholds */
 #define TASVIR_HEARTBEAT_US (1 * 1000 * 1000) /**< Time (microseconds) after which a node may be announced dead */
+#define TASVIR_EXT_NACK_US (200)              /**< Time (microseconds) before missing messages are asked for again */
+#define TASVIR_EXT_NACK_TRIES (4)             /**< Number of times missing frames are asked for before giving up */
 
 #define TASVIR_ETH_PROTO (0x88b6)                     /**< Ethernet protocol number to distinguish Tasvir traffic */
+#define TASVIR_ETH_MTU (1500)                         /**< Ethernet MTU of the port unless TASVIR_MTU sets it */
+#define TASVIR_ETH_MTU_MAX (9000)                     /**< Largest MTU (jumbo frames) TASVIR_MTU may set */
 #define TASVIR_MBUF_POOL_SIZE (size_t)((2 << 17) - 1) /**< Size of the DPDK packet mbuf pool */
 #define TASVIR_MBUF_CORE_CACHE_SIZE (size_t)(512)     /**< Size of the per-lcore mbuf cache size */
 #define TASVIR_PKT_BURST (32)                         /**< Packet burst size to use for I/O */
@@ -37,13 +45,19 @@
 
 #define TASVIR_NR_AREAS (1024)            /**< Maximum number of areas */
 #define TASVIR_NR_AREA_LOGS (4)           /**< Number of internal logs (time intervals) kept per area */
-#define TASVIR_NR_CACHELINES_PER_MSG (21) /**< Number of cachelines that fit in a single Tasvir message */
+#define TASVIR_NR_COPY_CLASSES (13)       /**< Number of run length classes (1KB to 4MB) with their own copy kernel */
+#define TASVIR_NR_CACHELINES_PER_MSG (21) /**< Number of cachelines in the first segment of a Tasvir message */
+#define TASVIR_NR_EXT_FRAMES (8192)       /**< Number of recently sent memory messages that can be resent */
+#define TASVIR_NR_EXT_GAPS (64)           /**< Maximum number of ranges of missing memory messages per node */
 #define TASVIR_NR_FN (4096)               /**< Maximum number of RPC functions */
+#define TASVIR_NR_LOG_BATCH (256)         /**< Maximum number of ranges staged in the thread-local write log */
 #define TASVIR_NR_RPC_ARGS (8)            /**< Maximum number of RPC function arguments */
 #define TASVIR_NR_RPC_MSG (256 * 1024)    /**< Maximum number of outstanding RPC messages */
 #define TASVIR_NR_NODES (64)              /**< Maximum number of nodes in Tasvir */
+#define TASVIR_NR_SNAPSHOTS (4)           /**< Maximum number of area versions pinned at once per node */
 #define TASVIR_NR_SOCKETS (2)             /**< Maximum number of CPU sockets per node */
 #define TASVIR_NR_SYNC_JOBS (2048)        /**< Maximum number of internal sync jobs */
+#define TASVIR_NR_SYNC_TASKS (16384)      /**< Maximum number of internal sync tasks (slices of jobs) */
 #define TASVIR_NR_THREADS_LOCAL (64)      /**< Maximum number of local threads */
 #define TASVIR_STRLEN_MAX (32)            /**< Maximum size of strings (bytes) */
 #define TASVIR_THREAD_DAEMON_IDX (0)      /**< Local thread index for the daemon thread */
@@ -51,18 +65,29 @@
 #define __TASVIR_LOG2(x) (31 - __builtin_clz(x | 1)) /**< Compile-time log2 for numbers that are power of two */
 
 #define TASVIR_CACHELINE_BYTES (64)                                    /**< Cache line size (bytes) */
+#define TASVIR_PAGE_BYTES (4096)                                       /**< Base page size (bytes) */
 #define TASVIR_LOG_GRANULARITY_BYTES (64)                              /**< Granularity of each log bit (bytes) */
+#define TASVIR_LOG_GRANULARITY_MIN_BYTES (8)                           /**< Finest per-area log granularity (bytes) */
+#define TASVIR_LOG_GRANULARITY_MAX_BYTES (4096)                        /**< Coarsest per-area log granularity (bytes) */
 #define TASVIR_LOG_UNIT_BITS (64)                                      /**< Number of bits in each log unit */
 #define TASVIR_SHIFT_BIT (__TASVIR_LOG2(TASVIR_LOG_GRANULARITY_BYTES)) /**<  */
 #define TASVIR_SHIFT_BYTE (TASVIR_SHIFT_BIT + __TASVIR_LOG2(CHAR_BIT)) /**<  */
 #define TASVIR_SHIFT_UNIT (TASVIR_SHIFT_BYTE + __TASVIR_LOG2(TASVIR_LOG_UNIT_BITS / CHAR_BIT)) /**<  */
+#define TASVIR_SHIFT_SUMMARY \
+    (TASVIR_SHIFT_UNIT + __TASVIR_LOG2(TASVIR_CACHELINE_BYTES * CHAR_BIT / TASVIR_LOG_UNIT_BITS)) /**<  */
+#define TASVIR_SHIFT_LOG_MAP \
+    (TASVIR_SHIFT_SUMMARY + __TASVIR_LOG2(TASVIR_LOG_GRANULARITY_MAX_BYTES / TASVIR_LOG_GRANULARITY_BYTES)) /**<  */
 
 #define TASVIR_ALIGNMENT (uintptr_t)(8 * (1 << TASVIR_SHIFT_UNIT)) /**< The default area alignment unit for Tasvir */
-#define TASVIR_ALIGNX(x, a) (((uintptr_t)(x) + a - 1) & ~(a - 1))  /**< Align address/size x per alignment a */
+#define TASVIR_ALIGNX(x, a) (((uintptr_t)(x) + (a)-1) & ~((a)-1))  /**< Align address/size x per alignment a */
 #define TASVIR_ALIGN(x) TASVIR_ALIGNX((x), TASVIR_ALIGNMENT)       /**< Align address/size x per TASVIR_ALIGNMENT */
 
 #define TASVIR_SIZE_DATA ((size_t)TASVIR_ALIGN(1UL << 40))                            /**< Data region size (bytes) */
 #define TASVIR_SIZE_LOG ((size_t)TASVIR_ALIGN(TASVIR_SIZE_DATA >> TASVIR_SHIFT_BYTE)) /**< Log region size (bytes) */
+#define TASVIR_SIZE_LOG_SUMMARY \
+    ((size_t)TASVIR_ALIGN(TASVIR_SIZE_LOG >> TASVIR_SHIFT_BYTE)) /**< Log summary region size (bytes) */
+#define TASVIR_SIZE_LOG_MAP \
+    ((size_t)TASVIR_ALIGN((TASVIR_SIZE_DATA >> TASVIR_SHIFT_LOG_MAP) * sizeof(uint64_t))) /**< Log map size (bytes) */
 #define TASVIR_SIZE_LOCAL ((size_t)TASVIR_ALIGN(1UL << 30))                           /**< Local region size (bytes) */
 
 #define TASVIR_ALIGN_DATA(x) TASVIR_ALIGNX(x, TASVIR_SIZE_DATA) /**< Align address/size x per data region size */
@@ -70,17 +95,31 @@
 #define TASVIR_ADDR_BASE ((uintptr_t)TASVIR_ALIGN_DATA(TASVIR_SIZE_DATA))      /**< Tasvir base virtual address */
 #define TASVIR_ADDR_DATA ((uintptr_t)(TASVIR_ADDR_BASE))                       /**< Data region base virtual address */
 #define TASVIR_ADDR_LOG ((uintptr_t)(TASVIR_ADDR_DATA + 2 * TASVIR_SIZE_DATA)) /**< Log region base virtual address */
-#define TASVIR_ADDR_LOCAL ((uintptr_t)(TASVIR_ADDR_LOG + TASVIR_SIZE_LOG))     /**< Local region base virtual address */
+#define TASVIR_ADDR_LOG_SUMMARY \
+    ((uintptr_t)(TASVIR_ADDR_LOG + TASVIR_SIZE_LOG)) /**< Log summary region base virtual address */
+#define TASVIR_ADDR_LOG_MAP \
+    ((uintptr_t)(TASVIR_ADDR_LOG_SUMMARY + TASVIR_SIZE_LOG_SUMMARY)) /**< Log map region base virtual address */
+#define TASVIR_ADDR_LOCAL \
+    ((uintptr_t)(TASVIR_ADDR_LOG_MAP + TASVIR_SIZE_LOG_MAP)) /**< Local region base virtual address */
 #define TASVIR_ADDR_END ((uintptr_t)(TASVIR_ADDR_LOCAL + TASVIR_SIZE_LOCAL))
 #define TASVIR_ADDR_DATA_RO ((uintptr_t)TASVIR_ALIGN_DATA(TASVIR_ADDR_END))
 #define TASVIR_ADDR_DATA_RW ((uintptr_t)(TASVIR_ADDR_DATA_RO + TASVIR_SIZE_DATA))
-#define TASVIR_ADDR_DPDK \
-    ((uintptr_t)(TASVIR_ADDR_DATA_RW + TASVIR_SIZE_DATA + 4 * (1UL << 30))) /**< DPDK base virtual address */
+#define TASVIR_ADDR_DATA_SPARE ((uintptr_t)(TASVIR_ADDR_DATA_RW + TASVIR_SIZE_DATA))
+#define TASVIR_ADDR_DATA_REPLICA \
+    ((uintptr_t)(TASVIR_ADDR_DATA_SPARE + TASVIR_SIZE_DATA)) /**< Replicas of sockets other than the first */
+#define TASVIR_ADDR_DATA_SNAPSHOT \
+    ((uintptr_t)(TASVIR_ADDR_DATA_REPLICA + (TASVIR_NR_SOCKETS - 1) * TASVIR_SIZE_DATA)) /**< Pinned snapshot pages */
+#define TASVIR_ADDR_DPDK                                                              \
+    ((uintptr_t)(TASVIR_ADDR_DATA_SNAPSHOT + TASVIR_NR_SNAPSHOTS * TASVIR_SIZE_DATA + \
+                 4 * (1UL << 30))) /**< DPDK base virtual address */
 
 #define TASVIR_SIZE_MAP (TASVIR_ADDR_END - TASVIR_ADDR_BASE)
 
 #define TASVIR_OFFSET_RO (TASVIR_ADDR_DATA_RO - TASVIR_ADDR_DATA)
 #define TASVIR_OFFSET_RW (TASVIR_ADDR_DATA_RW - TASVIR_ADDR_DATA)
+#define TASVIR_OFFSET_SPARE (TASVIR_ADDR_DATA_SPARE - TASVIR_ADDR_DATA)
+#define TASVIR_OFFSET_REPLICA (TASVIR_ADDR_DATA_REPLICA - TASVIR_ADDR_DATA)
+#define TASVIR_OFFSET_SNAPSHOT (TASVIR_ADDR_DATA_SNAPSHOT - TASVIR_ADDR_DATA)
 #define TASVIR_OFFSET_RO2RW (TASVIR_ADDR_DATA_RW - TASVIR_ADDR_DATA_RO)
 #define TASVIR_OFFSET_LOG (TASVIR_ADDR_LOG - TASVIR_ADDR_DATA)
 
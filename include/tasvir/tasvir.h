@@ -21,6 +21,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/uio.h>
 
 #include <tasvir/defs.h>
 #include <tasvir/types.h>
@@ -67,7 +68,8 @@ TASVIR_PUBLIC __attribute__((noinline)) int tasvir_service();
  * @param sync_req
  *   Request daemon to schedule a synchronization if set.
  * @return
- *   0 if an internal synchronization took place, an error code (-1 for now) otherwise.
+ *   0 if an internal synchronization took place (every round of a requested one when sync_req is set), an error
+ *   code (-1 for now) otherwise.
  * @note
  *   Same as tasvir_service() except that it requests and waits for an immediate internal synchronization.
  * @note
@@ -75,6 +77,43 @@ TASVIR_PUBLIC __attribute__((noinline)) int tasvir_service();
  */
 TASVIR_PUBLIC __attribute__((noinline)) int tasvir_service_wait(uint64_t timeout_us, bool sync_req);
 
+/**
+ * @brief
+ *   Waits until the local view of an area reaches a version.
+ *
+ * Spins through tasvir_service() for a short adaptive time, then sleeps until the sync that publishes the version
+ * wakes the thread. A sleeping thread takes no part in internal synchronizations.
+ *
+ * @param d
+ *   The area descriptor.
+ * @param version
+ *   The version to wait for.
+ * @param timeout_us
+ *   The timeout in microseconds.
+ * @return
+ *   0 once d->h->version is at least version, -1 on timeout.
+ */
+TASVIR_PUBLIC __attribute__((noinline)) int tasvir_wait_version(const tasvir_area_desc *d, uint64_t version,
+                                                                uint64_t timeout_us);
+
+/**
+ * @brief
+ *   Subscribes to the next version of an area through an eventfd, for threads that sleep in poll or epoll.
+ *
+ * @param d
+ *   The area descriptor.
+ * @param version
+ *   The version to wait for.
+ * @return
+ *   An eventfd that becomes readable once d reaches version, or -1 on failure. The same eventfd is returned for
+ *   every subscription of the thread.
+ * @note
+ *   The thread takes no part in internal synchronizations and must not touch Tasvir areas from the subscription until
+ *   its next tasvir_service(). The eventfd may also fire when a synchronization needs the thread; read it, call
+ *   tasvir_service() and check the version.
+ */
+TASVIR_PUBLIC __attribute__((noinline)) int tasvir_wait_version_fd(const tasvir_area_desc *d, uint64_t version);
+
 /**
  * @brief
  *   Marks the current thread inactive; synchronization will proceed without this thread.
@@ -105,6 +144,49 @@ TASVIR_PUBLIC __attribute__((noinline)) void tasvir_area_activate(tasvir_area_de
  *   The specification of the area to be created.
  * @return
  *   The created area descriptor or NULL in case of failure.
+ * @note
+ *   Set TASVIR_AREA_OPT_TRACK_AUTO in d.opts to have writes to the area detected through kernel dirty-page tracking
+ *   at every internal synchronization. The area then needs no tasvir_log calls, at the cost of page faults on the
+ *   first write to each of its pages after a synchronization. This needs write-protect userfaultfd support for
+ *   shared memory and PAGEMAP_SCAN (Linux 6.7). On older kernels the soft-dirty bits of the whole process are
+ *   cleared instead, so every page of the writer process, including its heap and other areas, faults on its
+ *   first write after each synchronization of an automatically tracked area.
+ * @note
+ *   Set d.log_bytes to choose how many bytes each log bit tracks for this area.
+ *   Coarse granularity shrinks the log and sync scan time of bulk-written areas, while fine granularity shrinks the
+ *   bytes copied and sent for areas of small scattered fields. Areas with a non-default granularity are aligned to
+ *   2MB and those finer than the default reserve proportionally more address space for their log.
+ * @note
+ *   Set TASVIR_AREA_OPT_EPOCH in d.opts to have the writer publish the area from its own tasvir_service calls into
+ *   a spare copy that readers switch to at their next tasvir_service, instead of copying it within the node-wide
+ *   barrier. Readers never wait on the writer or on each other; a publication is skipped while a reader still
+ *   uses the spare copy. Not supported for containers and automatically tracked areas.
+ *   Set d.sync_budget_us as well to bound the time each tasvir_service of the writer spends copying: large change
+ *   sets are then copied over several calls and published once all of them landed in the spare copy.
+ *   With sync helpers running (TASVIR_SYNC_HELPERS of the daemon), the writer hands its logged lines off and a
+ *   helper copies them. Only epoch areas are offloaded this way: the threads of other areas still wait at the
+ *   barrier and copy them themselves, and helpers stay out of that barrier.
+ * @note
+ *   Set TASVIR_AREA_OPT_REPLICATE in d.opts to keep one read-only copy of the area per socket. Readers map the copy
+ *   of the socket of their tasvir thread, trading a copy per socket during each sync for local reads. Not supported
+ *   for containers and epoch areas.
+ * @note
+ *   Set TASVIR_AREA_OPT_COMPARE in d.opts to have the internal synchronization compare each logged line with the
+ *   published copy and drop the lines that did not change, so that rewriting identical values is neither copied
+ *   nor sent to other nodes. This trades a read of both copies for each logged line; tasvir_stats reports the
+ *   dropped bytes as isync_suppressed_bytes. Not supported for epoch areas.
+ * @note
+ *   Set d.sync_overhead_pct to let the daemon pick the sync intervals of the area: it shortens them while the
+ *   synchronizations of the area take less than that share of time, given their measured barrier and copy costs
+ *   and the rate at which the area changes. d.sync_int_us and d.sync_ext_us then become the longest intervals.
+ *   tasvir_stats reports the range of the intervals in use across such areas as sync_int_us_min/max and
+ *   sync_ext_us_min/max.
+ *   Set d.sync_dirty_bytes to also sync the area early once about that many bytes of it were logged; the count is
+ *   an upper bound at the granularity of a log cacheline. Automatically tracked areas do not sync early.
+ * @note
+ *   Set TASVIR_AREA_OPT_COMPRESS in d.opts to have the daemon zero-run encode the external synchronization messages
+ *   of the area at word granularity, so that sparse or mostly zero updates take less of the link. Combine it with a
+ *   fine d.log_bytes to send only the words that changed. tasvir_stats reports the bytes sent as esync_wire_bytes.
  */
 TASVIR_PUBLIC __attribute__((noinline)) tasvir_area_desc *tasvir_new(tasvir_area_desc d);
 
@@ -199,7 +281,81 @@ TASVIR_PUBLIC __attribute__((noinline)) int tasvir_update_owner(tasvir_area_desc
  */
 static inline void *tasvir_data(tasvir_area_desc *d) { return d->h + 1; }
 
+/**
+ * @brief
+ *   Pin the current version of an area for a long-running reader.
+ *
+ * The returned view keeps showing that version while later syncs update the area. Pages are only copied aside
+ * the first time a sync changes them, so pins of areas that change little are cheap.
+ *
+ * @param d
+ *   The area descriptor.
+ * @return
+ *   Pointer to the user memory of the pinned version, or NULL in case of failure (e.g., no free snapshot slot).
+ * @note
+ *   Epoch areas cannot be pinned. Up to TASVIR_NR_SNAPSHOTS versions may be pinned per node at once.
+ */
+TASVIR_PUBLIC __attribute__((noinline)) const void *tasvir_snapshot_pin(const tasvir_area_desc *d);
+
+/**
+ * @brief
+ *   Release a pinned version.
+ *
+ * @param data
+ *   The pointer returned by tasvir_snapshot_pin.
+ */
+TASVIR_PUBLIC __attribute__((noinline)) void tasvir_snapshot_unpin(const void *data);
+
 /* LOG */
+/**
+ * @brief
+ *   Set bits \p idx0 to \p idx1 (inclusive) of a log summary.
+ *
+ * Summary words are shared by neighboring areas, so new bits are set atomically.
+ *
+ * @param summary
+ *   The log summary.
+ * @param idx0
+ *   The first summary bit.
+ * @param idx1
+ *   The last summary bit.
+ */
+static inline void tasvir_log_summary_set(tasvir_log_t *__restrict summary, size_t idx0, size_t idx1) {
+    size_t i0 = idx0 / TASVIR_LOG_UNIT_BITS;
+    size_t i1 = idx1 / TASVIR_LOG_UNIT_BITS;
+    for (size_t i = i0; i <= i1; i++) {
+        tasvir_log_t mask = ~(tasvir_log_t)0;
+        if (i == i0)
+            mask >>= idx0 % TASVIR_LOG_UNIT_BITS;
+        if (i == i1)
+            mask &= (1L << 63) >> (idx1 % TASVIR_LOG_UNIT_BITS);
+        if ((summary[i] & mask) != mask)  // the common case is a summary bit already set
+            __atomic_fetch_or(&summary[i], mask, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief
+ *   Find the log bit tracking the address \p data.
+ *
+ * Areas with the default granularity use the log bit at the address's natural position.
+ * Other areas are registered in the log map and pack their bits at the start of their own log range.
+ *
+ * @param data
+ *   The address.
+ * @return
+ *   The log bit index.
+ */
+static inline size_t tasvir_data2logbit(uintptr_t data) {
+    uintptr_t offset = data & (TASVIR_SIZE_DATA - 1);
+    uint64_t map = ((const uint64_t *)TASVIR_ADDR_LOG_MAP)[offset >> TASVIR_SHIFT_LOG_MAP];
+    if (!map)
+        return offset >> TASVIR_SHIFT_BIT;
+    uintptr_t base = map & ~((1UL << TASVIR_SHIFT_LOG_MAP) - 1);
+    int shift = map & ((1UL << TASVIR_SHIFT_LOG_MAP) - 1);
+    return (base >> TASVIR_SHIFT_BIT) + ((offset - base) >> shift);
+}
+
 /**
  * @brief
  *   Log a change of \p len bytes to the address \p data.
@@ -211,8 +367,8 @@ static inline void *tasvir_data(tasvir_area_desc *d) { return d->h + 1; }
  */
 static inline void tasvir_log(const void *__restrict data, size_t len) {
     /* find the start and end bit offset in the log corresponding to the start and end address */
-    size_t logbit_idx0 = _pext_u64((uintptr_t)data, (TASVIR_SIZE_DATA - 1) & (~0UL << TASVIR_SHIFT_BIT));
-    size_t logbit_idx1 = _pext_u64((uintptr_t)data + len - 1, (TASVIR_SIZE_DATA - 1) & (~0UL << TASVIR_SHIFT_BIT));
+    size_t logbit_idx0 = tasvir_data2logbit((uintptr_t)data);
+    size_t logbit_idx1 = tasvir_data2logbit((uintptr_t)data + len - 1);
     size_t logunit_idx0 = logbit_idx0 >> (TASVIR_SHIFT_UNIT - TASVIR_SHIFT_BIT);
     size_t logunit_idx1 = logbit_idx1 >> (TASVIR_SHIFT_UNIT - TASVIR_SHIFT_BIT);
     tasvir_log_t mask0 = ~(tasvir_log_t)0 >> (logbit_idx0 % TASVIR_LOG_UNIT_BITS);
@@ -231,12 +387,43 @@ static inline void tasvir_log(const void *__restrict data, size_t len) {
             log[i] = ~(tasvir_log_t)0;
         log[logdiff] |= mask1;
     }
+    tasvir_log_summary_set((tasvir_log_t *)TASVIR_ADDR_LOG_SUMMARY,
+                           logunit_idx0 >> (TASVIR_SHIFT_SUMMARY - TASVIR_SHIFT_UNIT),
+                           logunit_idx1 >> (TASVIR_SHIFT_SUMMARY - TASVIR_SHIFT_UNIT));
 
 #ifdef TASVIR_DEBUG_TRACKING
     fprintf(stderr, "%16d %-22.22s %p (%luB) log/offset:%p/%u\n", 0, "tasvir_log", data, len, (void *)log, logbit_idx);
 #endif
 }
 
+/**
+ * @brief
+ *   Out-of-line variant of tasvir_log() for callers that cannot inline it.
+ *
+ * @param data
+ *   Changed address; must be inside the Tasvir data region.
+ * @param len
+ *   Change size in bytes.
+ * @note
+ *   Calls to this function are emitted by the LLVM instrumentation pass (src/llvm_pass.cpp).
+ */
+TASVIR_PUBLIC __attribute__((noinline)) void tasvir_log_noinline(const void *data, size_t len);
+
+/**
+ * @brief
+ *   Log changes to a vector of \p n address ranges.
+ *
+ * @param iov
+ *   The changed ranges.
+ * @param n
+ *   Number of ranges in \p iov.
+ * @note
+ *   Ranges are staged in a thread-local buffer and flushed into the log in a single sorted and merged pass
+ *   once the buffer fills up or at the next tasvir_service().
+ *   Prefer this over tasvir_log() in write-heavy loops that touch many ranges between two service calls.
+ */
+TASVIR_PUBLIC __attribute__((noinline)) void tasvir_logv(const struct iovec *iov, size_t n);
+
 /* RPC */
 /**
  * @brief
@@ -54,6 +54,17 @@ typedef enum {
     TASVIR_AREA_TYPE_APP
 } tasvir_area_type;
 
+/**
+ * Per-area options chosen at creation time.
+ */
+typedef enum {
+    TASVIR_AREA_OPT_TRACK_AUTO = 1 << 0, /* track writes through kernel dirty-page tracking instead of tasvir_log */
+    TASVIR_AREA_OPT_EPOCH = 1 << 1,      /* publish through a spare copy and epochs instead of the sync barrier */
+    TASVIR_AREA_OPT_REPLICATE = 1 << 2,  /* keep a read-only replica per socket for readers on that socket */
+    TASVIR_AREA_OPT_COMPARE = 1 << 3,    /* skip the logged lines that still match the published copy */
+    TASVIR_AREA_OPT_COMPRESS = 1 << 4,   /* zero-run encode the memory messages of external syncs */
+} tasvir_area_opt;
+
 /**
  *
  */
@@ -115,20 +126,26 @@ typedef struct tasvir_thread tasvir_thread;
  *
  */
 typedef struct tasvir_area_desc {
-    tasvir_area_desc *pd;  /* parent descriptor */
-    tasvir_area_header *h; /* the header */
-    tasvir_thread *owner;  /* current owner */
-    size_t len;            /* area length including the metadata (header and log) */
-    size_t offset_log_end; /* offset of last loggable byte */
-    size_t nr_areas_max;   /* maximum number of child areas; valid for container type areas */
+    tasvir_area_desc *pd;       /* parent descriptor */
+    tasvir_area_header *h;      /* the header */
+    tasvir_thread *owner;       /* current owner */
+    size_t len;                 /* area length including the metadata (header and log) */
+    size_t len_data;            /* length of the data asked for at creation */
+    size_t offset_log_end;      /* offset of last loggable byte */
+    size_t nr_areas_max;        /* maximum number of child areas; valid for container type areas */
     union {
         tasvir_str name;
         tasvir_str_static name0;
-    };                     /* name of the area */
-    uint64_t boot_us;      /* time first initialized in microseconds */
-    uint64_t sync_int_us;  /* internal synchronization interval in microseconds */
-    uint64_t sync_ext_us;  /* external synchronization interval in microseconds */
-    tasvir_area_type type; /* area type */
+    };                          /* name of the area */
+    uint64_t boot_us;           /* time first initialized in microseconds */
+    uint64_t sync_int_us;       /* internal synchronization interval in microseconds; the longest when adapting */
+    uint64_t sync_ext_us;       /* external synchronization interval in microseconds; the longest when adapting */
+    uint64_t sync_budget_us;    /* time the writer of an epoch area copies per tasvir_service; 0 for no limit */
+    uint64_t sync_dirty_bytes;  /* sync early once this many bytes are dirty; 0 for no limit */
+    uint32_t sync_overhead_pct; /* share of time its syncs may take when adapting the intervals; 0 keeps them fixed */
+    uint32_t opts;              /* area options (tasvir_area_opt) */
+    uint32_t log_bytes;         /* bytes tracked by each log bit: a power of two in [8, 4096] or 0 for the default */
+    tasvir_area_type type;      /* area type */
 } tasvir_area_desc;
 
 /**
@@ -140,6 +157,7 @@ typedef struct tasvir_area_log {
     uint64_t version_end;
     uint64_t end_us;
     tasvir_log_t *data;
+    tasvir_log_t *summary; /* one bit per cacheline of data */
 } tasvir_area_log;
 
 /**
@@ -150,9 +168,13 @@ typedef struct __attribute__((aligned(TASVIR_CACHELINE_BYTES))) tasvir_area_head
 #ifndef __cplusplus
         struct {
             uint64_t flags_;
-            uint64_t last_sync_ext_bytes_;
+            uint64_t last_sync_ext_seq_; /* sequence number of the next message of the version being sent/received */
             uint64_t last_sync_ext_us_;
             uint64_t last_sync_ext_v_;
+            uint64_t epoch_;        /* epoch of the copy; the writer copy holds the epoch last published */
+            uint64_t epoch_retire_; /* node epoch after which no reader may still see the previous copy */
+            uint64_t epoch_us_;     /* time of the last publication */
+            uint64_t epoch_lock_;   /* serializes publication and external sync; also holds the hand-off state */
         };
 #endif
         uint8_t pad_[1 << TASVIR_SHIFT_BIT];
@@ -176,14 +198,25 @@ typedef struct tasvir_stats {
     uint64_t isync_success;
     uint64_t isync_failure;
     uint64_t isync_barrier_us;
+    uint64_t isync_barrier_level_us[TASVIR_BARRIER_LEVELS]; /* until every node of a level of the barrier combined */
     uint64_t isync_us; /* inclusive of isync_barrier_us */
     uint64_t isync_changed_bytes;
     uint64_t isync_processed_bytes;
+    uint64_t isync_suppressed_bytes; /* logged but identical to the published copy */
 
     uint64_t esync_cnt;
     uint64_t esync_us;
     uint64_t esync_changed_bytes;
     uint64_t esync_processed_bytes;
+    uint64_t esync_wire_bytes; /* payload of outgoing memory messages as sent */
+    uint64_t esync_lost;       /* incoming memory messages found missing */
+    uint64_t esync_resent;     /* outgoing memory messages sent again on request */
+
+    /* range of the intervals in use for areas with a sync_overhead_pct as of the last update; 0 without such areas */
+    uint64_t sync_int_us_min;
+    uint64_t sync_int_us_max;
+    uint64_t sync_ext_us_min;
+    uint64_t sync_ext_us_max;
 
     uint64_t rx_bytes;
     uint64_t tx_bytes;
@@ -1,3 +1,5 @@
+#include <numaif.h>
+
 #include "tasvir.h"
 
 void tasvir_area_activate(tasvir_area_desc *d, bool active) {
@@ -106,22 +108,55 @@ size_t tasvir_area_walk(tasvir_area_desc *d, tasvir_fnptr_walkcb fnptr) {
 }
 #endif
 
-static inline void tasvir_update_va(const tasvir_area_desc *d, bool is_rw) {
-    if (tasvir_area_is_mapped_rw(d) == is_rw)
-        return;
+static inline void tasvir_map_va(const tasvir_area_desc *d, size_t offset) {
     size_t len = d->offset_log_end;
-    size_t offset = (uintptr_t)d->h - TASVIR_ADDR_BASE + is_rw * TASVIR_SIZE_DATA;
     void *ret = mmap(d->h, len, PROT_READ | PROT_WRITE, MAP_NORESERVE | MAP_SHARED | MAP_FIXED, ttld.fd, offset);
     if (ret != d->h) {
         LOG_ERR("mmap for data area failed (request=%p return=%p). aborting...", (void *)d->h, ret);
         abort();
     }
+}
+
+/* file offset of the copy that readers of d map */
+static inline size_t tasvir_published_offset(const tasvir_area_desc *d) {
+    size_t offset = (uintptr_t)d->h - TASVIR_ADDR_BASE;
+    int replica = tasvir_area_replica(d);
+    if (replica)
+        return offset + TASVIR_SIZE_MAP + replica * TASVIR_SIZE_DATA;
+    uint8_t *h_pub = tasvir_data2pub(d, d->h);
+    return offset + (h_pub == tasvir_data2ro(d->h) ? 0 : TASVIR_SIZE_MAP);
+}
+
+/* place the replica of each socket on that socket's memory */
+static void tasvir_area_bind_replicas(const tasvir_area_desc *d) {
+    size_t len = TASVIR_ALIGNX(d->offset_log_end, TASVIR_PAGE_BYTES);
+    for (int socket = 1; socket < TASVIR_NR_SOCKETS; socket++) {
+        unsigned long nodemask = 1UL << socket;
+        if (mbind(tasvir_data2replica(d->h, socket), len, MPOL_PREFERRED, &nodemask, sizeof(nodemask) * CHAR_BIT, 0))
+            LOG_ERR("name=%s socket=%d mbind failed (%s)", d->name, socket, strerror(errno));
+    }
+}
+
+static inline void tasvir_update_va(const tasvir_area_desc *d, bool is_rw) {
+    if (tasvir_area_is_mapped_rw(d) == is_rw)
+        return;
+    tasvir_map_va(d, is_rw ? (uintptr_t)d->h - TASVIR_ADDR_BASE + TASVIR_SIZE_DATA : tasvir_published_offset(d));
     if (is_rw)
         d->h->flags_ |= TASVIR_AREA_FLAG_MAPPED_RW;
 
     LOG_INFO("name=%s mapping=%s", d->name, is_rw ? "rw" : "ro");
 }
 
+bool tasvir_area_map_published(const tasvir_area_desc *d) {
+    if (!(d->opts & TASVIR_AREA_OPT_EPOCH) || !d->h || tasvir_area_is_mapped_rw(d))
+        return false;
+    const tasvir_area_header *h_rw = tasvir_data2rw(d->h);
+    if (d->h->epoch_ == __atomic_load_n(&h_rw->epoch_, __ATOMIC_ACQUIRE))
+        return false;
+    tasvir_map_va(d, tasvir_published_offset(d));
+    return true;
+}
+
 tasvir_area_desc *tasvir_new_alloc_desc(tasvir_area_desc desc) {
     tasvir_area_desc *d = NULL;
     void *h = NULL;
@@ -157,6 +192,9 @@ tasvir_area_desc *tasvir_new_alloc_desc(tasvir_area_desc desc) {
         d = &c[*nr_areas];
         h = (void *)TASVIR_ALIGN((*nr_areas > 0 ? (uint8_t *)c[*nr_areas - 1].h + c[*nr_areas - 1].len
                                                 : (uint8_t *)c + desc.pd->nr_areas_max * sizeof(tasvir_area_desc)));
+        /* areas with a non-default granularity own their log map entries */
+        if (tasvir_area_log_shift(&desc) != TASVIR_SHIFT_BIT)
+            h = (void *)TASVIR_ALIGNX(h, 1UL << TASVIR_SHIFT_LOG_MAP);
         if ((uint8_t *)h + desc.len >= (uint8_t *)desc.pd->h->diff_log[0].data) {
             LOG_ERR("d=%s out of space", desc.pd->name);
             return NULL;
@@ -197,13 +235,58 @@ tasvir_area_desc *tasvir_new(tasvir_area_desc desc) {
 #endif
     if (!desc.pd && ttld.node)
         desc.pd = ttld.root_desc;
+    if (desc.type == TASVIR_AREA_TYPE_CONTAINER && desc.opts & TASVIR_AREA_OPT_TRACK_AUTO) {
+        LOG_ERR("automatic tracking is not supported for containers");
+        return NULL;
+    }
+    if (desc.opts & TASVIR_AREA_OPT_EPOCH &&
+        (desc.type == TASVIR_AREA_TYPE_CONTAINER || desc.opts & TASVIR_AREA_OPT_TRACK_AUTO)) {
+        LOG_ERR("epoch publication is not supported for containers and automatically tracked areas");
+        return NULL;
+    }
+    if (desc.opts & TASVIR_AREA_OPT_REPLICATE &&
+        (desc.type == TASVIR_AREA_TYPE_CONTAINER || desc.opts & TASVIR_AREA_OPT_EPOCH)) {
+        LOG_ERR("socket replicas are not supported for containers and epoch areas");
+        return NULL;
+    }
+    if (desc.opts & TASVIR_AREA_OPT_COMPARE && desc.opts & TASVIR_AREA_OPT_EPOCH) {
+        LOG_ERR("compare-before-copy is not supported for epoch areas");
+        return NULL;
+    }
+
+    if (desc.log_bytes == 0)
+        desc.log_bytes = TASVIR_LOG_GRANULARITY_BYTES;
+    if (desc.log_bytes < TASVIR_LOG_GRANULARITY_MIN_BYTES || desc.log_bytes > TASVIR_LOG_GRANULARITY_MAX_BYTES ||
+        (desc.log_bytes & (desc.log_bytes - 1))) {
+        LOG_ERR("invalid log granularity %u", desc.log_bytes);
+        return NULL;
+    }
+    if (desc.type == TASVIR_AREA_TYPE_CONTAINER && desc.log_bytes != TASVIR_LOG_GRANULARITY_BYTES) {
+        LOG_ERR("containers must use the default log granularity");
+        return NULL;
+    }
 
-    /* calculate space requirements */
+    /* calculate space requirements: each log cacheline must cover whole data so that sync can work per cacheline */
+    desc.len_data = desc.len;
+    int log_shift = tasvir_area_log_shift(&desc);
+    size_t align = MAX(TASVIR_ALIGNMENT, 1UL << (log_shift + TASVIR_SHIFT_SUMMARY - TASVIR_SHIFT_BIT));
     size_t size_metadata = sizeof(tasvir_area_header) + desc.nr_areas_max * sizeof(tasvir_area_desc);
-    desc.offset_log_end = TASVIR_ALIGN(size_metadata + (desc.type == TASVIR_AREA_TYPE_CONTAINER ? 0 : desc.len));
-    size_t offset_log = TASVIR_ALIGN(size_metadata + desc.len);
-    size_t size_log = TASVIR_ALIGNX(desc.offset_log_end >> TASVIR_SHIFT_BYTE, sizeof(tasvir_log_t));
-    desc.len = offset_log + TASVIR_ALIGN(TASVIR_NR_AREA_LOGS * size_log);
+    desc.offset_log_end =
+        TASVIR_ALIGNX(size_metadata + (desc.type == TASVIR_AREA_TYPE_CONTAINER ? 0 : desc.len), align);
+    size_t offset_log = TASVIR_ALIGNX(size_metadata + desc.len, align);
+    size_t size_log = desc.offset_log_end >> (log_shift + __TASVIR_LOG2(CHAR_BIT));
+    size_t size_summary =
+        TASVIR_ALIGNX(desc.offset_log_end >> (log_shift + TASVIR_SHIFT_SUMMARY - TASVIR_SHIFT_BIT),
+                      TASVIR_LOG_UNIT_BITS) / CHAR_BIT;
+    /* epoch areas keep two more logs: the lines their spare copy missed in the previous epoch and a hand-off log */
+    size_t nr_logs = TASVIR_NR_AREA_LOGS + (desc.opts & TASVIR_AREA_OPT_EPOCH ? 2 : 0);
+    desc.len = offset_log + TASVIR_ALIGN(nr_logs * (size_log + size_summary));
+    if (log_shift != TASVIR_SHIFT_BIT) {
+        /* the area packs its log bits into the log range of its own addresses, so reserve enough of them */
+        if (log_shift < TASVIR_SHIFT_BIT)
+            desc.len = MAX(desc.len, desc.offset_log_end << (TASVIR_SHIFT_BIT - log_shift));
+        desc.len = TASVIR_ALIGNX(desc.len, 1UL << TASVIR_SHIFT_LOG_MAP);
+    }
 
     /* allocate descriptor: may be a local or a remote request */
     tasvir_area_desc *d = tasvir_new_alloc_desc(desc);
@@ -234,6 +317,13 @@ tasvir_area_desc *tasvir_new(tasvir_area_desc desc) {
     tasvir_area_header *h_rw = tasvir_data2rw(d->h);
     memset(h_rw, 0, size_metadata);
     memset(h_ro, 0, size_metadata);
+    if (desc.opts & TASVIR_AREA_OPT_EPOCH)
+        memset(tasvir_data2spare(d->h), 0, size_metadata);
+    if (desc.opts & TASVIR_AREA_OPT_REPLICATE) {
+        tasvir_area_bind_replicas(d);
+        for (int socket = 1; socket < TASVIR_NR_SOCKETS; socket++)
+            memset(tasvir_data2replica(d->h, socket), 0, size_metadata);
+    }
 
     tasvir_update_owner(d, desc.owner);
     tasvir_area_header *h = d->h;
@@ -253,6 +343,7 @@ tasvir_area_desc *tasvir_new(tasvir_area_desc desc) {
         log->start_us = h->time_us;
         log->end_us = 0;
         log->data = (tasvir_log_t *)((uint8_t *)h + offset_log + i * size_log);
+        log->summary = (tasvir_log_t *)((uint8_t *)h + offset_log + nr_logs * size_log + i * size_summary);
     }
     if (ttld.node && tasvir_area_add_user(d, ttld.node, -1)) {
         LOG_ERR("failed to add local node as a subscriber of d=%s", d->name);
@@ -409,6 +500,15 @@ tasvir_area_desc *tasvir_attach(const char *name) {
         pd = d;
     } while ((tok = strtok(NULL, "/")));
 
+    /* readers on other sockets switch to their replica */
+    if (tasvir_area_replica(d) && !tasvir_area_is_mapped_rw(d))
+        tasvir_map_va(d, tasvir_published_offset(d));
+    /* take part in the syncs of d from now on */
+    if (ttld.tdata) {
+        size_t bit = tasvir_area_filter_bit(d);
+        ttld.tdata->areas_filter[bit / 64] |= 1UL << (bit % 64);
+    }
+
     char area_str[256];
     tasvir_area_str(d, area_str, sizeof(area_str));
     LOG_INFO("%s", area_str);
@@ -455,10 +555,17 @@ int tasvir_update_owner(tasvir_area_desc *d, tasvir_thread *owner) {
 
     tasvir_area_header *h_rw = tasvir_data2rw(d->h);
     tasvir_area_header *h_ro = tasvir_data2ro(d->h);
+    tasvir_area_header *h_spare = tasvir_data2spare(d->h);
     if (is_new_owner) {
         tasvir_update_va(d, true);
+        tasvir_log_map_update(d);
         h_rw->flags_ |= TASVIR_AREA_FLAG_LOCAL;
         h_ro->flags_ |= TASVIR_AREA_FLAG_LOCAL;
+        if (d->opts & TASVIR_AREA_OPT_EPOCH)
+            h_spare->flags_ |= TASVIR_AREA_FLAG_LOCAL;
+        if (d->opts & TASVIR_AREA_OPT_REPLICATE)
+            for (int socket = 1; socket < TASVIR_NR_SOCKETS; socket++)
+                ((tasvir_area_header *)tasvir_data2replica(d->h, socket))->flags_ |= TASVIR_AREA_FLAG_LOCAL;
 
         if (!is_old_owner) {
             tasvir_rpc_status *s = tasvir_rpc(d, (tasvir_fnptr)&tasvir_update_owner, d, owner);
@@ -472,6 +579,11 @@ int tasvir_update_owner(tasvir_area_desc *d, tasvir_thread *owner) {
         if (memcmp(&owner->tid.nid, &d->owner->tid.nid, sizeof(tasvir_nid))) {
             h_rw->flags_ &= ~TASVIR_AREA_FLAG_LOCAL;
             h_ro->flags_ &= ~TASVIR_AREA_FLAG_LOCAL;
+            if (d->opts & TASVIR_AREA_OPT_EPOCH)
+                h_spare->flags_ &= ~TASVIR_AREA_FLAG_LOCAL;
+            if (d->opts & TASVIR_AREA_OPT_REPLICATE)
+                for (int socket = 1; socket < TASVIR_NR_SOCKETS; socket++)
+                    ((tasvir_area_header *)tasvir_data2replica(d->h, socket))->flags_ &= ~TASVIR_AREA_FLAG_LOCAL;
         }
     }
 
@@ -1,19 +1,22 @@
 #ifdef TASVIR_DAEMON
 #include <assert.h>
 #include <errno.h>
-#include <execinfo.h>
 #include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
 #include <rte_cycles.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "tasvir.h"
 
-#define BACKTRACE_BUFSIZE 32
+extern char **environ;
 
 /*
 void usage(char *exec) {
@@ -22,16 +25,55 @@ void usage(char *exec) {
 }
 */
 
-void handler(int sig) {
-    void *buf[BACKTRACE_BUFSIZE];
-    int nptrs = backtrace(buf, BACKTRACE_BUFSIZE);
-    fprintf(stderr, "Error: received signal %d.\n", sig);
-    backtrace_symbols_fd(buf, nptrs, STDERR_FILENO);
-    exit(1);
+/* reap the sync helpers that exit so that they do not linger as zombies */
+static void reap_helpers(int sig __attribute__((unused))) {
+    int saved_errno = errno;
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+        ;
+    errno = saved_errno;
+}
+
+/* start a sync helper next to this executable on each core of the comma separated TASVIR_SYNC_HELPERS */
+static void spawn_helpers() {
+    char *cores = getenv("TASVIR_SYNC_HELPERS");
+    if (!cores)
+        return;
+
+    char path[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (len < 0) {
+        LOG_ERR("failed to find the daemon executable (%s)", strerror(errno));
+        return;
+    }
+    path[len] = '\0';
+    char helper[PATH_MAX + 16];
+    snprintf(helper, sizeof(helper), "%s/tasvir_helper", dirname(path));
+
+    /* helpers find their core in TASVIR_CORE like any other tasvir process */
+    struct sigaction sa = {.sa_handler = reap_helpers, .sa_flags = SA_RESTART | SA_NOCLDSTOP};
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+
+    char *core_daemon = strdup(getenv("TASVIR_CORE"));
+    cores = strdup(cores);
+    for (char *saveptr, *core = strtok_r(cores, ",", &saveptr); core; core = strtok_r(NULL, ",", &saveptr)) {
+        pid_t pid;
+        char *argv[] = {helper, NULL};
+        setenv("TASVIR_CORE", core, 1);
+        int retval = posix_spawn(&pid, helper, NULL, NULL, argv, environ);
+        if (retval) {
+            LOG_ERR("failed to spawn %s on core %s (%s)", helper, core, strerror(retval));
+        } else {
+            LOG_INFO("spawned sync helper pid=%d on core %s", pid, core);
+        }
+    }
+    free(cores);
+    setenv("TASVIR_CORE", core_daemon, 1);
+    free(core_daemon);
 }
 
 int main() {
-    signal(SIGSEGV, handler);
+    signal(SIGSEGV, tasvir_backtrace_handler);
     /*
     int core = -1;
     char *pciaddr = NULL;
@@ -90,6 +132,7 @@ int main() {
         fprintf(stderr, "tasvir_init_daemon failed\n");
         return -1;
     }
+    spawn_helpers();
 
     while (true) {
         tasvir_service();
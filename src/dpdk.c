@@ -97,13 +97,39 @@ int tasvir_init_port() {
     uint64_t end_tsc;
     int retval;
 
+    /* frames longer than an mbuf are received and sent as chains of segments */
+    unsigned long mtu = TASVIR_ETH_MTU;
+    char* mtu_str = getenv("TASVIR_MTU");
+    if (mtu_str) {
+        char* end;
+        mtu = strtoul(mtu_str, &end, 10);
+        if (*end || mtu < RTE_ETHER_MTU || mtu > TASVIR_ETH_MTU_MAX) {
+            LOG_ERR("TASVIR_MTU=%s is not between %d and %d", mtu_str, RTE_ETHER_MTU, TASVIR_ETH_MTU_MAX);
+            return -1;
+        }
+    }
+
     /* prepare configs */
     memset(&port_conf, 0, sizeof(port_conf));
     rte_eth_dev_info_get(ttld.ndata->port_id, &dev_info);
     port_conf.txmode.mq_mode = ETH_MQ_TX_NONE;
     port_conf.rxmode.mq_mode = ETH_MQ_RX_NONE;
-    port_conf.rxmode.max_rx_pkt_len = RTE_ETHER_MAX_LEN;
+    port_conf.rxmode.max_rx_pkt_len = mtu + RTE_ETHER_HDR_LEN + RTE_ETHER_CRC_LEN;
     port_conf.rxmode.split_hdr_size = 0;
+    if (port_conf.rxmode.max_rx_pkt_len > dev_info.max_rx_pktlen) {
+        LOG_ERR("mtu=%lu exceeds max_rx_pktlen=%u of port=%d", mtu, dev_info.max_rx_pktlen, ttld.ndata->port_id);
+        return -1;
+    }
+    if (mtu > RTE_ETHER_MTU) {
+        uint64_t rx_offloads = DEV_RX_OFFLOAD_JUMBO_FRAME | DEV_RX_OFFLOAD_SCATTER;
+        if ((dev_info.rx_offload_capa & rx_offloads) != rx_offloads ||
+            !(dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MULTI_SEGS)) {
+            LOG_ERR("port=%d does not support jumbo frames in multiple segments", ttld.ndata->port_id);
+            return -1;
+        }
+        port_conf.rxmode.offloads |= rx_offloads;
+        port_conf.txmode.offloads |= DEV_TX_OFFLOAD_MULTI_SEGS;
+    }
     // port_conf.rxmode.offloads = DEV_RX_OFFLOAD_CRC_STRIP;
     port_conf.intr_conf.lsc = 0;
 
@@ -113,6 +139,17 @@ int tasvir_init_port() {
         return -1;
     }
 
+    /* ports start at the standard MTU and some PMDs do not implement setting it */
+    if (mtu != RTE_ETHER_MTU) {
+        retval = rte_eth_dev_set_mtu(ttld.ndata->port_id, mtu);
+        if (retval < 0) {
+            LOG_ERR("rte_eth_dev_set_mtu: err=%d, port=%u, mtu=%lu", retval, ttld.ndata->port_id, mtu);
+            return -1;
+        }
+    }
+    ttld.ndata->mtu = mtu;
+    ttld.ndata->msg_mem_bytes = TASVIR_MSG_MEM_MTU_BYTES(mtu);
+
     retval = rte_eth_rx_queue_setup(ttld.ndata->port_id, 0, TASVIR_RING_EXT_SIZE,
                                     rte_eth_dev_socket_id(ttld.ndata->port_id), NULL, ttld.ndata->mp);
     if (retval < 0) {
@@ -155,7 +192,7 @@ int tasvir_init_port() {
 
     tasvir_str buf;
     ether_ntoa_r(&ttld.ndata->mac_addr, buf);
-    LOG_INFO("port=%d mac=%s", ttld.ndata->port_id, buf);
+    LOG_INFO("port=%d mac=%s mtu=%lu msg_mem=%luB", ttld.ndata->port_id, buf, mtu, ttld.ndata->msg_mem_bytes);
 
     return 0;
 }
@@ -0,0 +1,25 @@
+#include <rte_cycles.h>
+
+#include "tasvir.h"
+
+/* a sync helper takes over the copies handed off by the writers of epoch areas. only epoch areas are offloaded:
+ * the barrier syncs of other areas are still copied by their own threads and the helper does not join them. it is
+ * spawned by the daemon on each core listed in TASVIR_SYNC_HELPERS and runs on the core in TASVIR_CORE.
+ */
+
+int main() {
+    signal(SIGSEGV, tasvir_backtrace_handler);
+
+    if (!tasvir_init()) {
+        fprintf(stderr, "tasvir_init failed\n");
+        return -1;
+    }
+    ttld.tdata->is_helper = true;
+
+    while (true) {
+        tasvir_service();
+        rte_delay_us_block(1);
+    }
+
+    return 0;
+}
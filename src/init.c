@@ -1,11 +1,67 @@
+#include <cpuid.h>
 #include <fcntl.h>
 #include <numaif.h>
 #include <rte_eal.h>
+#include <sched.h>
+#include <stdio.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include "tasvir.h"
 
+/* where the thread runs: sync tasks are steered to threads near the pages they touch and the barrier tree
+ * combines threads that share a last level cache first
+ */
+static void tasvir_init_topology() {
+    ttld.tdata->socket = MAX((int)rte_socket_id(), 0);
+    ttld.tdata->cpu = MAX(sched_getcpu(), 0);
+    ttld.tdata->llc = -1;
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index3/id", ttld.tdata->cpu);
+    FILE *f = fopen(path, "r");
+    if (f) {
+        if (fscanf(f, "%d", &ttld.tdata->llc) != 1)
+            ttld.tdata->llc = -1;
+        fclose(f);
+    }
+}
+
+/* pick the sync kernel variants for this cpu; TASVIR_ISA=sse4|avx2|avx512 narrows the choice */
+static void tasvir_init_isa() {
+    static const char *isa_str[TASVIR_NR_ISA] = {"sse4", "avx2", "avx512"};
+    __builtin_cpu_init();
+    bool supported[TASVIR_NR_ISA] = {
+        __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"),
+        __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") && __builtin_cpu_supports("popcnt"),
+        __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+            __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("bmi"),
+    };
+
+    ttld.isa = TASVIR_ISA_SSE4;
+    for (int i = TASVIR_NR_ISA - 1; i > TASVIR_ISA_SSE4; i--) {
+        if (supported[i]) {
+            ttld.isa = i;
+            break;
+        }
+    }
+
+    char *isa_env = getenv("TASVIR_ISA");
+    if (isa_env) {
+        int i;
+        for (i = 0; i < TASVIR_NR_ISA && strcmp(isa_env, isa_str[i]); i++)
+            ;
+        if (i < TASVIR_NR_ISA && supported[i])
+            ttld.isa = i;
+        else
+            LOG_ERR("ignoring TASVIR_ISA=%s (unknown or unsupported by this cpu)", isa_env);
+    }
+    LOG_INFO("using %s sync kernels", isa_str[ttld.isa]);
+
+    /* enhanced rep movsb/stosb (cpuid leaf 7, ebx bit 9) enables the string copy kernel */
+    unsigned int eax, ebx, ecx, edx;
+    ttld.has_erms = __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1 << 9));
+}
+
 static int tasvir_init_local() {
     void *base;
 #ifdef TASVIR_DAEMON
@@ -21,7 +77,8 @@ static int tasvir_init_local() {
         LOG_ERR("shm_open failed (%s)", strerror(errno));
         return -1;
     }
-    if (ftruncate(ttld.fd, TASVIR_SIZE_MAP)) {
+    /* the spare copy of epoch areas, the socket replicas and the snapshot slots follow the map in the file */
+    if (ftruncate(ttld.fd, TASVIR_SIZE_MAP + (TASVIR_NR_SOCKETS + TASVIR_NR_SNAPSHOTS) * TASVIR_SIZE_DATA)) {
         LOG_ERR("ftruncate failed (%s)", strerror(errno));
         return -1;
     }
@@ -38,6 +95,13 @@ static int tasvir_init_local() {
         return -1;
     }
     madvise((void *)TASVIR_ADDR_DATA_RO, TASVIR_SIZE_DATA * 2, MADV_HUGEPAGE);
+    base = mmap((void *)TASVIR_ADDR_DATA_SPARE, (TASVIR_NR_SOCKETS + TASVIR_NR_SNAPSHOTS) * TASVIR_SIZE_DATA,
+                PROT_READ | PROT_WRITE, MAP_NORESERVE | MAP_SHARED, ttld.fd, TASVIR_SIZE_MAP);
+    if (base != (void *)TASVIR_ADDR_DATA_SPARE) {
+        LOG_ERR("mmap failed asked %p got %p", (void *)TASVIR_ADDR_DATA_SPARE, base);
+        return -1;
+    }
+    madvise((void *)TASVIR_ADDR_DATA_SPARE, TASVIR_NR_SOCKETS * TASVIR_SIZE_DATA, MADV_HUGEPAGE);
 
     ttld.ndata = (void *)TASVIR_ADDR_LOCAL;
     ttld.tdata = &ttld.ndata->tdata[TASVIR_THREAD_DAEMON_IDX];
@@ -57,8 +121,9 @@ static int tasvir_init_local() {
     pthread_mutex_init(&ttld.ndata->mutex_init, &mutex_attr);
     pthread_mutexattr_destroy(&mutex_attr);
     ttld.ndata->barrier_end_tsc = 0;
-    ttld.ndata->barrier_cnt = -1;
     ttld.ndata->barrier_seq = 1;
+    ttld.ndata->mtu = TASVIR_ETH_MTU;
+    ttld.ndata->msg_mem_bytes = TASVIR_MSG_MEM_BYTES;
 
     /* mempool */
     ttld.ndata->mp = rte_pktmbuf_pool_create("mempool", TASVIR_MBUF_POOL_SIZE, TASVIR_MBUF_CORE_CACHE_SIZE, 0,
@@ -85,7 +150,6 @@ static int tasvir_init_local() {
             (void *)ttld.ndata->ring_mem_pending);
 
     /* timing */
-    ttld.ndata->sync_int_us = TASVIR_SYNC_INTERNAL_US;
     ttld.ndata->sync_ext_us = TASVIR_SYNC_EXTERNAL_US;
     ttld.ndata->tsc2usec_mult = 1E6 / rte_get_tsc_hz();
     ttld.ndata->boot_us = ttld.ndata->time_us = tasvir_time_us();
@@ -163,6 +227,7 @@ static int tasvir_init_node() {
     /* initializing boot_us so that could later use this node's clock rather than root's */
     ttld.node_desc = tasvir_new((tasvir_area_desc){.pd = ttld.root_desc,
                                                    .type = TASVIR_AREA_TYPE_NODE,
+                                                   .opts = TASVIR_AREA_OPT_EPOCH,
                                                    .name0 = *(tasvir_str_static *)name,
                                                    .len = sizeof(tasvir_node),
                                                    .nr_areas_max = 0});
@@ -174,6 +239,7 @@ static int tasvir_init_node() {
     memset(ttld.node, 0, sizeof(tasvir_node));
     memcpy(&ttld.node->nid.mac_addr, &ttld.ndata->mac_addr, ETH_ALEN);
     ttld.node->heartbeat_us = TASVIR_HEARTBEAT_US;
+    ttld.node->mtu = ttld.ndata->mtu;
 
     /* time */
     tasvir_log(ttld.node, sizeof(tasvir_node));
@@ -322,6 +388,7 @@ tasvir_area_desc *tasvir_init() {
     }
     /* ttld has static storage and is automatically zero-initialized */
 
+    tasvir_init_isa();
     tasvir_init_rpc();
 
     if (tasvir_init_dpdk()) {
@@ -335,6 +402,8 @@ tasvir_area_desc *tasvir_init() {
     }
 
 #ifdef TASVIR_DAEMON
+    tasvir_init_tune();
+
     if (tasvir_init_port()) {
         LOG_ERR("tasvir_init_port failed");
         return NULL;
@@ -357,6 +426,7 @@ tasvir_area_desc *tasvir_init() {
         return NULL;
     }
     ttld.tdata = &ttld.ndata->tdata[ttld.thread->tid.idx];
+    tasvir_init_topology();
 
     if (tasvir_init_finish(ttld.thread)) {
         LOG_ERR("tasvir_init_finish failed");
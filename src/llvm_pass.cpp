@@ -1,99 +1,264 @@
+/* Tasvir write instrumentation for clang (new pass manager, LLVM >= 14).
+ *
+ * Inserts tasvir_log_noinline() calls for every write that may land in the Tasvir data region:
+ * - writes to stack, globals and fresh heap objects are filtered out statically; the rest get an inline range check
+ * - constant-offset writes to the same base within a basic block are merged into one range per block
+ * - strided stores in call-free loops with a computable trip count are logged once as a range after the loop
+ *
+ * Usage: clang -fpass-plugin=libtasvir_pass.so ... (or opt -load-pass-plugin=libtasvir_pass.so -passes=tasvir)
+ * Set TASVIR_PASS_VERBOSE in the environment of the compiler to print the instrumented writes.
+ */
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
-#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Instructions.h"
 #include "llvm/IR/IntrinsicInst.h"
-#include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
-#include "llvm/IR/Type.h"
-#include "llvm/Pass.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
 #include "llvm/Support/raw_ostream.h"
-#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
+
+#include "tasvir/defs.h"
 
 using namespace llvm;
 
 namespace {
-struct TasvirPass : public FunctionPass {
-    static char ID;
-    TasvirPass() : FunctionPass(ID) {}
+enum class Region { Outside, Inside, Unknown };
+
+/* a write of len bytes to ptr */
+struct Write {
+    Value *ptr;
+    Value *len;
+};
+
+/* a pending constant-offset range [start, end) relative to base */
+struct Range {
+    Value *base;
+    int64_t start;
+    int64_t end;
+    Region region;
+};
+
+/* a tasvir_log_noinline(ptr + offset, len) call to insert before insertBefore */
+struct LogSite {
+    Instruction *insertBefore;
+    Value *ptr;
+    int64_t offset;
+    Value *len;
+    Region region;
+};
+
+bool getWrite(Instruction &inst, const DataLayout &layout, Write &w) {
+    Type *valType;
+    if (auto *op = dyn_cast<StoreInst>(&inst)) {
+        w.ptr = op->getPointerOperand();
+        valType = op->getValueOperand()->getType();
+    } else if (auto *op = dyn_cast<AtomicRMWInst>(&inst)) {
+        w.ptr = op->getPointerOperand();
+        valType = op->getValOperand()->getType();
+    } else if (auto *op = dyn_cast<AtomicCmpXchgInst>(&inst)) {
+        w.ptr = op->getPointerOperand();
+        valType = op->getNewValOperand()->getType();
+    } else if (auto *op = dyn_cast<AnyMemIntrinsic>(&inst)) {
+        w.ptr = op->getRawDest();
+        w.len = op->getLength();
+        return w.ptr->getType()->getPointerAddressSpace() == 0;
+    } else {
+        return false;
+    }
+    w.len = ConstantInt::get(Type::getInt64Ty(inst.getContext()), layout.getTypeStoreSize(valType).getFixedSize());
+    return w.ptr->getType()->getPointerAddressSpace() == 0;
+}
+
+/* where a write may land; only the Unknown case needs a check at runtime */
+Region classify(Value *ptr) {
+    if (auto *ce = dyn_cast<ConstantExpr>(ptr)) {
+        if (ce->getOpcode() == Instruction::IntToPtr)
+            if (auto *ci = dyn_cast<ConstantInt>(ce->getOperand(0)))
+                return ci->getZExtValue() - TASVIR_ADDR_DATA < TASVIR_SIZE_DATA ? Region::Inside : Region::Outside;
+    }
+    const Value *obj = getUnderlyingObject(ptr, 0);
+    if (isa<AllocaInst>(obj) || isa<GlobalValue>(obj) || isNoAliasCall(obj))
+        return Region::Outside;
+    return Region::Unknown;
+}
+
+/* whether inst may reach tasvir_service() and hence a sync; pending ranges must be logged before it */
+bool maySync(const Instruction &inst) {
+    const auto *call = dyn_cast<CallBase>(&inst);
+    return call && !isa<IntrinsicInst>(call);
+}
+
+struct TasvirPass : public PassInfoMixin<TasvirPass> {
+    PreservedAnalyses run(Function &f, FunctionAnalysisManager &fam) {
+        if (f.isDeclaration() || f.getName().startswith("tasvir_"))
+            return PreservedAnalyses::all();
 
-    bool runOnFunction(Function &f) override {
         const DataLayout &layout = f.getParent()->getDataLayout();
-        LLVMContext &ctx = f.getContext();
-        Constant *logFunc = f.getParent()->getOrInsertFunction("tasvir_log", Type::getVoidTy(ctx), Type::getInt8PtrTy(ctx),
-                                                               Type::getInt64Ty(ctx), NULL);
-
-        for (auto &block : f) {
-            for (auto &inst : block) {
-                Value *dst;
-                Value *len;
-                if (isa<CallInst>(inst)) {
-                    /*
-                    Value *callee = inst.getOperand(inst.getNumOperands() - 1);
-                    if(callee->getName().str() != "llvm.var.annotation")
-                        continue;
-                    Value *annotatedValue = inst.getOperand(0);
-                    if(annotatedValue->getValueID() != Value::InstructionVal + Instruction::BitCast)
-                        continue;
-                    Argument *a = mapValueToArgument[annotatedValue->getUnderlyingObject()];
-                    if(!a)
-                        continue;
-
-                    Value *annotation = inst.getOperand(1);
-                    if(annotation->getValueID() != Value::ConstantExprVal)
-                        continue;
-                    ConstantExpr *ce = (ConstantExpr *)annotation;
-                    if(ce->getOpcode() != Instruction::GetElementPtr)
-                        continue;
-
-                    // `ConstantExpr` operands: http://llvm.org/docs/LangRef.html#constantexprs
-                    Value *gv = ce->getOperand(0);
-
-                    if(gv->getValueID() != Value::GlobalVariableVal)
-                        continue;
-
-                    Value *v = module->getNamedValue(gv->getName().str())->getOperand(0);
-                    assert (v->getValueID() == Value::ConstantArrayVal);
-                    ConstantArray *ca = (ConstantArray *)v;
-                    std::string annotation_str = ca->getAsString();
-                    std::cout << "    argument " << a->getType()->getDescription() << " " << a->getName().str()
-                        << " has annotation \"" << getGlobalVariableString(gv->getName().str()) << "\"\n";
-                    */
-                } else if (isa<StoreInst>(inst) || isa<AtomicRMWInst>(inst)) {
-                    dst = inst.getOperand(1);
-                    len = ConstantInt::get(Type::getInt64Ty(ctx), layout.getTypeAllocSize(dst->getType()));
-                } else if (isa<AtomicCmpXchgInst>(inst)) {
-                    dst = inst.getOperand(0);
-                    len = ConstantInt::get(Type::getInt64Ty(ctx), layout.getTypeAllocSize(dst->getType()));
-                } else if (isa<MemIntrinsic>(inst)) {
-                    auto *op = dyn_cast<MemIntrinsic>(&inst);
-                    dst = op->getDest();
-                    len = op->getLength();
-                } else {
+        LoopInfo &li = fam.getResult<LoopAnalysis>(f);
+        ScalarEvolution &se = fam.getResult<ScalarEvolutionAnalysis>(f);
+        SmallVector<LogSite, 32> sites;
+        SmallPtrSet<Instruction *, 32> hoisted;
+
+        for (Loop *l : li.getLoopsInPreorder())
+            hoistLoop(*l, li, se, layout, sites, hoisted);
+        for (auto &block : f)
+            coalesceBlock(block, layout, sites, hoisted);
+
+        if (sites.empty())
+            return PreservedAnalyses::all();
+        emit(f, sites);
+        return PreservedAnalyses::none();
+    }
+
+    static bool isRequired() { return true; }
+
+  private:
+    /* log the strided stores of a call-free loop with a computable trip count once, at its exit */
+    static void hoistLoop(Loop &l, LoopInfo &li, ScalarEvolution &se, const DataLayout &layout,
+                          SmallVectorImpl<LogSite> &sites, SmallPtrSetImpl<Instruction *> &hoisted) {
+        BasicBlock *preheader = l.getLoopPreheader();
+        BasicBlock *exit = l.getExitBlock();
+        if (!preheader || !exit || !l.hasDedicatedExits() || exit->getFirstInsertionPt() == exit->end())
+            return;
+        for (BasicBlock *block : l.blocks())
+            for (Instruction &inst : *block)
+                if (maySync(inst))
+                    return;
+        const SCEV *btc = se.getBackedgeTakenCount(&l);
+        if (isa<SCEVCouldNotCompute>(btc))
+            return;
+
+        Type *int64Ty = Type::getInt64Ty(preheader->getContext());
+        Type *int8PtrTy = Type::getInt8PtrTy(preheader->getContext());
+        Instruction *expandAt = preheader->getTerminator();
+        SCEVExpander expander(se, layout, "tasvir");
+        btc = se.getTruncateOrZeroExtend(btc, int64Ty);
+
+        for (BasicBlock *block : l.blocks()) {
+            if (li.getLoopFor(block) != &l)
+                continue;
+            for (Instruction &inst : *block) {
+                Write w;
+                if (!isa<StoreInst>(inst) || !getWrite(inst, layout, w))
                     continue;
-                }
-                if (isa<AllocaInst>(dst))
+                Region region = classify(w.ptr);
+                auto *ar = dyn_cast<SCEVAddRecExpr>(se.getSCEV(w.ptr));
+                if (region == Region::Outside || !ar || ar->getLoop() != &l || !ar->isAffine())
+                    continue;
+                auto *step = dyn_cast<SCEVConstant>(ar->getStepRecurrence(se));
+                int64_t size = cast<ConstantInt>(w.len)->getSExtValue();
+                int64_t stride = step ? step->getAPInt().getSExtValue() : 0;
+                /* only dense enough strides so that the range does not log many untouched cachelines */
+                if (!stride || std::abs(stride) > std::max<int64_t>(size, TASVIR_CACHELINE_BYTES))
                     continue;
 
-                // Insert *after* `op`.
-                IRBuilder<> builder(&inst);
-                builder.SetInsertPoint(&block, ++builder.GetInsertPoint());
-                Value *args[] = {dst, len};
-                builder.CreateCall(logFunc, args);
-                errs() << inst << "\n\t";
-                errs().write_escaped(inst.getOpcodeName())
-                    << " *dst:" << *dst << " type:" << *dst->getType() << " len:" << *len << "\n";
+                const SCEV *span = se.getMulExpr(btc, se.getConstant(int64Ty, std::abs(stride)));
+                const SCEV *start = stride > 0 ? ar->getStart() : se.getMinusSCEV(ar->getStart(), span);
+                const SCEV *len = se.getAddExpr(span, se.getConstant(int64Ty, size));
+                if (!isSafeToExpandAt(start, expandAt, se) || !isSafeToExpandAt(len, expandAt, se))
+                    continue;
+                sites.push_back({&*exit->getFirstInsertionPt(), expander.expandCodeFor(start, int8PtrTy, expandAt), 0,
+                                 expander.expandCodeFor(len, int64Ty, expandAt), region});
+                hoisted.insert(&inst);
             }
         }
+    }
 
-        return false;
+    /* merge constant-offset writes to the same base until the next possible sync point */
+    static void coalesceBlock(BasicBlock &block, const DataLayout &layout, SmallVectorImpl<LogSite> &sites,
+                              const SmallPtrSetImpl<Instruction *> &hoisted) {
+        SmallVector<Range, 8> pending;
+        for (Instruction &inst : block) {
+            Write w;
+            if (!hoisted.count(&inst) && getWrite(inst, layout, w)) {
+                Region region = classify(w.ptr);
+                if (region == Region::Outside)
+                    continue;
+                int64_t offset = 0;
+                auto *len = dyn_cast<ConstantInt>(w.len);
+                Value *base = len ? GetPointerBaseWithConstantOffset(w.ptr, offset, layout) : nullptr;
+                if (!base) {
+                    sites.push_back({inst.getNextNode(), w.ptr, 0, w.len, region});
+                    continue;
+                }
+                int64_t end = offset + len->getSExtValue();
+                /* allow gaps within a cacheline: they cost at most one extra logged line */
+                auto r = std::find_if(pending.begin(), pending.end(), [&](const Range &r) {
+                    return r.base == base && offset <= r.end + TASVIR_CACHELINE_BYTES &&
+                           end + TASVIR_CACHELINE_BYTES >= r.start;
+                });
+                if (r == pending.end()) {
+                    pending.push_back({base, offset, end, region});
+                } else {
+                    r->start = std::min(r->start, offset);
+                    r->end = std::max(r->end, end);
+                }
+            } else if (inst.isTerminator() || maySync(inst)) {
+                for (Range &r : pending)
+                    sites.push_back({&inst, r.base, r.start, ConstantInt::get(Type::getInt64Ty(inst.getContext()),
+                                                                              r.end - r.start),
+                                     r.region});
+                pending.clear();
+            }
+        }
     }
 
-};  // end of struct TasvirPass
-}  // end of anonymous namespace
+    static void emit(Function &f, ArrayRef<LogSite> sites) {
+        LLVMContext &ctx = f.getContext();
+        Type *int64Ty = Type::getInt64Ty(ctx);
+        Type *int8PtrTy = Type::getInt8PtrTy(ctx);
+        FunctionCallee logFunc =
+            f.getParent()->getOrInsertFunction("tasvir_log_noinline", Type::getVoidTy(ctx), int8PtrTy, int64Ty);
+        bool verbose = getenv("TASVIR_PASS_VERBOSE");
 
-char TasvirPass::ID = 0;
-static RegisterPass<TasvirPass> X("tasvir_pass", "Tasvir Instrumentation Pass", false /* Only looks at CFG */,
-                                  false /* Analysis Pass */);
+        for (const LogSite &site : sites) {
+            IRBuilder<> builder(site.insertBefore);
+            Value *ptr = builder.CreatePointerCast(site.ptr, int8PtrTy);
+            if (site.offset)
+                ptr = builder.CreateConstGEP1_64(builder.getInt8Ty(), ptr, site.offset);
+            Value *len = builder.CreateZExtOrTrunc(site.len, int64Ty);
+            if (site.region == Region::Unknown) {
+                /* (ptr - TASVIR_ADDR_DATA) < TASVIR_SIZE_DATA */
+                Value *offset = builder.CreateSub(builder.CreatePtrToInt(ptr, int64Ty),
+                                                  ConstantInt::get(int64Ty, TASVIR_ADDR_DATA));
+                Value *inside = builder.CreateICmpULT(offset, ConstantInt::get(int64Ty, TASVIR_SIZE_DATA));
+                builder.SetInsertPoint(SplitBlockAndInsertIfThen(inside, site.insertBefore, false));
+            }
+            builder.CreateCall(logFunc, {ptr, len});
+            if (verbose)
+                errs() << "tasvir: " << f.getName() << ": logging " << *site.ptr << " +" << site.offset
+                       << " len:" << *site.len << (site.region == Region::Unknown ? " (checked)" : "") << "\n";
+        }
+    }
+};
+}  // end of anonymous namespace
 
-static void registerTasvirPass(const PassManagerBuilder &, legacy::PassManagerBase &PM) { PM.add(new TasvirPass()); }
-static RegisterStandardPasses RegisterTasvirPass(PassManagerBuilder::EP_EarlyAsPossible, registerTasvirPass);
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo() {
+    return {LLVM_PLUGIN_API_VERSION, "TasvirPass", LLVM_VERSION_STRING, [](PassBuilder &pb) {
+                /* run last so that inlining and loop canonicalization have already happened */
+                pb.registerOptimizerLastEPCallback([](ModulePassManager &mpm, OptimizationLevel) {
+                    mpm.addPass(createModuleToFunctionPassAdaptor(TasvirPass()));
+                });
+                pb.registerPipelineParsingCallback(
+                    [](StringRef name, FunctionPassManager &fpm, ArrayRef<PassBuilder::PipelineElement>) {
+                        if (name != "tasvir")
+                            return false;
+                        fpm.addPass(TasvirPass());
+                        return true;
+                    });
+            }};
+}
@@ -0,0 +1,113 @@
+#include "tasvir.h"
+
+/* insertion sort since ranges are mostly logged in address order */
+static void tasvir_log_batch_sort(tasvir_log_range *r, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+        tasvir_log_range tmp = r[i];
+        size_t j = i;
+        while (j > 0 && r[j - 1].bit_start > tmp.bit_start) {
+            r[j] = r[j - 1];
+            j--;
+        }
+        r[j] = tmp;
+    }
+}
+
+/* set log bits bit_start to bit_end (inclusive) and return their count; full units are written a cacheline at a time */
+TASVIR_INLINE size_t tasvir_log_set_bits_impl(size_t bit_start, size_t bit_end) {
+    tasvir_log_t *__restrict log = (tasvir_log_t *)TASVIR_ADDR_LOG;
+    size_t unit_start = bit_start / TASVIR_LOG_UNIT_BITS;
+    size_t unit_end = bit_end / TASVIR_LOG_UNIT_BITS;
+    tasvir_log_t mask_start = ~(tasvir_log_t)0 >> (bit_start % TASVIR_LOG_UNIT_BITS);
+    tasvir_log_t mask_end = (1L << 63) >> (bit_end % TASVIR_LOG_UNIT_BITS);
+
+    const int summary_shift = TASVIR_SHIFT_SUMMARY - TASVIR_SHIFT_BIT;
+    tasvir_log_summary_set((tasvir_log_t *)TASVIR_ADDR_LOG_SUMMARY, bit_start >> summary_shift,
+                           bit_end >> summary_shift);
+
+    if (unit_start == unit_end) {
+        tasvir_log_t val_new = log[unit_start] | (mask_start & mask_end);
+        if (log[unit_start] != val_new)
+            log[unit_start] = val_new;
+        return bit_end - bit_start + 1;
+    }
+
+    if ((log[unit_start] & mask_start) != mask_start)
+        log[unit_start] |= mask_start;
+    if ((log[unit_end] & mask_end) != mask_end)
+        log[unit_end] |= mask_end;
+
+    const tasvir_log_vec ones_v = ~(tasvir_log_vec){0};
+    const size_t unit_per_vec = sizeof(tasvir_log_vec) / sizeof(tasvir_log_t);
+    size_t i = unit_start + 1;
+    for (; i < unit_end && i % unit_per_vec; i++)
+        log[i] = ~(tasvir_log_t)0;
+    for (; i + unit_per_vec <= unit_end; i += unit_per_vec) {
+        /* skip the store when the whole line is already set to save coherency traffic */
+        tasvir_log_vec unset = ~*(tasvir_log_vec *)&log[i];
+        if (!tasvir_log_vec_is_zero(&unset))
+            *(tasvir_log_vec *)&log[i] = ones_v;
+    }
+    for (; i < unit_end; i++)
+        log[i] = ~(tasvir_log_t)0;
+    return bit_end - bit_start + 1;
+}
+
+TASVIR_ISA_DISPATCH(static, size_t, tasvir_log_set_bits, (size_t bit_start, size_t bit_end), (bit_start, bit_end))
+
+void tasvir_log_flush() {
+    size_t n = ttld.nr_log_batch;
+    if (!n)
+        return;
+
+    tasvir_log_range *__restrict r = ttld.log_batch;
+    tasvir_log_batch_sort(r, n);
+
+    /* merge overlapping and adjacent ranges so that each log unit is written at most once */
+    size_t bit_start = r[0].bit_start;
+    size_t bit_end = r[0].bit_end;
+    for (size_t i = 1; i < n; i++) {
+        if (r[i].bit_start <= bit_end + 1) {
+            bit_end = MAX(bit_end, r[i].bit_end);
+        } else {
+            tasvir_log_set_bits(bit_start, bit_end);
+            bit_start = r[i].bit_start;
+            bit_end = r[i].bit_end;
+        }
+    }
+    tasvir_log_set_bits(bit_start, bit_end);
+
+    ttld.nr_log_batch = 0;
+}
+
+void tasvir_log_noinline(const void *data, size_t len) { tasvir_log(data, len); }
+
+void tasvir_logv(const struct iovec *iov, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (!iov[i].iov_len)
+            continue;
+        if (ttld.nr_log_batch >= TASVIR_NR_LOG_BATCH)
+            tasvir_log_flush();
+        tasvir_log_range *r = &ttld.log_batch[ttld.nr_log_batch++];
+        r->bit_start = tasvir_data2logbit((uintptr_t)iov[i].iov_base);
+        r->bit_end = tasvir_data2logbit((uintptr_t)iov[i].iov_base + iov[i].iov_len - 1);
+    }
+}
+
+void tasvir_log_area(const tasvir_area_desc *d, const void *data, size_t len) {
+    int shift = tasvir_area_log_shift(d);
+    size_t bit_base = ((uintptr_t)d->h - TASVIR_ADDR_DATA) >> TASVIR_SHIFT_BIT;
+    size_t offset = (uintptr_t)data - (uintptr_t)d->h;
+    tasvir_log_set_bits(bit_base + (offset >> shift), bit_base + ((offset + len - 1) >> shift));
+}
+
+void tasvir_log_map_update(const tasvir_area_desc *d) {
+    int shift = tasvir_area_log_shift(d);
+    if (shift == TASVIR_SHIFT_BIT)
+        return;
+
+    uint64_t *map = (uint64_t *)TASVIR_ADDR_LOG_MAP;
+    uintptr_t base = (uintptr_t)d->h - TASVIR_ADDR_DATA;
+    for (uintptr_t offset = base; offset < base + d->len; offset += 1UL << TASVIR_SHIFT_LOG_MAP)
+        map[offset >> TASVIR_SHIFT_LOG_MAP] = base | shift;
+}
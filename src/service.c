@@ -1,5 +1,10 @@
+#include <linux/futex.h>
+#include <pthread.h>
 #include <rte_ethdev.h>
 #include <stdarg.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "tasvir.h"
 
@@ -38,6 +43,10 @@ static inline void tasvir_service_port_rx() {
                 if (!memcmp(&m[i]->eh.ether_dhost, &ttld.ndata->memcast_tid.nid.mac_addr, ETH_ALEN)) {
                     valid = true;
                     tasvir_handle_msg_mem((tasvir_msg_mem *)m[i]);
+                } else if (m[i]->type == TASVIR_MSG_TYPE_MEM_NACK &&
+                           !memcmp(&m[i]->eh.ether_dhost, &ttld.ndata->mac_addr, ETH_ALEN)) {
+                    valid = true;
+                    tasvir_handle_msg_nack((tasvir_msg_nack *)m[i]);
                 } else if (!memcmp(&m[i]->eh.ether_dhost, &ttld.ndata->mac_addr, ETH_ALEN) ||
                            !memcmp(&m[i]->eh.ether_dhost, &ttld.ndata->rpccast_tid.nid.mac_addr, ETH_ALEN)) {
                     valid = true;
@@ -45,7 +54,7 @@ static inline void tasvir_service_port_rx() {
                 }
             }
             if (!valid) {
-                rte_mempool_put(ttld.ndata->mp, (void *)m[i]);
+                rte_pktmbuf_free(&m[i]->mbuf);
             }
         }
     }
@@ -55,8 +64,11 @@ static inline void tasvir_service_port_rx() {
 static inline void tasvir_service_ring(struct rte_ring *ring, bool rpc) {
     tasvir_msg *m[TASVIR_PKT_BURST];
     unsigned count;
+    /* bounded by the initial occupancy since handling a message may enqueue it back */
+    unsigned left = rte_ring_count(ring);
 
-    while ((count = rte_ring_sc_dequeue_burst(ring, (void **)m, TASVIR_PKT_BURST, NULL)) > 0) {
+    while (left && (count = rte_ring_sc_dequeue_burst(ring, (void **)m, MIN(left, TASVIR_PKT_BURST), NULL)) > 0) {
+        left -= count;
         for (unsigned i = 0; i < count; i++)
             if (rpc)
                 tasvir_handle_msg_rpc(m[i], TASVIR_MSG_SRC_LOCAL);
@@ -82,6 +94,8 @@ static void tasvir_service_io() {
     /* physical port */
     if (!ttld.is_root || tasvir_is_running()) {  // no I/O during root's boot
         tasvir_service_port_rx();
+        if (ttld.ndata->nr_ext_gaps)
+            tasvir_service_nacks();
         tasvir_service_port_tx();
     }
 #endif
@@ -104,10 +118,123 @@ void tasvir_service_nodes() {
             tasvir_attach_wait(100 * MS2US, c[i].name);
 }
 
+/* version waits: a waiting thread parks so that syncs go on without it, and whoever publishes the version it waits
+ * for wakes it through a futex in the shared thread data. parked threads must not touch area data until they call
+ * tasvir_service again.
+ */
+
+void tasvir_wake(tasvir_local_tdata *tdata) {
+    atomic_fetch_add(&tdata->wake_seq, 1);
+    syscall(SYS_futex, &tdata->wake_seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* wake the parked threads waiting for a version that d now has */
+void tasvir_wake_waiters(const tasvir_area_desc *d) {
+    /* pairs with the check of the version after parking */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load_explicit(&ttld.ndata->nr_parked, memory_order_relaxed))
+        return;
+    uint64_t version = ((tasvir_area_header *)tasvir_data2pub(d, d->h))->version;
+    for (size_t tid = 0; tid < TASVIR_NR_THREADS_LOCAL; tid++) {
+        tasvir_local_tdata *tdata = &ttld.ndata->tdata[tid];
+        if (atomic_load(&tdata->parked) && tdata->wait_d == d && tdata->wait_version <= version)
+            tasvir_wake(tdata);
+    }
+}
+
+/* park until the next service; returns false if the thread must not sleep because d has the version already or a
+ * sync counts on the thread. threads holding pins never park since syncs that skip them leave their pins stale.
+ */
+static bool tasvir_park(const tasvir_area_desc *d, uint64_t version) {
+    if (ttld.nr_pins)
+        return false;
+    ttld.tdata->wait_d = d;
+    ttld.tdata->wait_version = version;
+    if (!atomic_exchange(&ttld.tdata->parked, true))
+        atomic_fetch_add(&ttld.ndata->nr_parked, 1);
+    return ttld.tdata->next_sync_seq == ttld.tdata->prev_sync_seq &&
+           ((tasvir_area_header *)tasvir_data2pub(d, d->h))->version < version;
+}
+
+static void tasvir_unpark() {
+    if (!atomic_load_explicit(&ttld.tdata->parked, memory_order_relaxed))
+        return;
+    atomic_store(&ttld.tdata->parked, false);
+    atomic_fetch_sub(&ttld.ndata->nr_parked, 1);
+}
+
+int tasvir_wait_version(const tasvir_area_desc *d, uint64_t version, uint64_t timeout_us) {
+    uint64_t now_tsc = __rdtsc();
+    uint64_t end_tsc = now_tsc + tasvir_usec2tsc(timeout_us);
+    if (!ttld.wait_spin_us)
+        ttld.wait_spin_us = TASVIR_WAIT_SPIN_US;
+
+    /* spin through the service routine first since most waits end within a sync or two */
+    uint64_t spin_end_tsc = MIN(end_tsc, now_tsc + tasvir_usec2tsc(ttld.wait_spin_us));
+    bool reached;
+    while (!(reached = d->h->version >= version) && __rdtsc() < spin_end_tsc) {
+        tasvir_service();
+        _mm_pause();
+    }
+    /* spin as long next time if that was enough and shorter otherwise */
+    ttld.wait_spin_us = reached ? MIN(ttld.wait_spin_us * 2, TASVIR_WAIT_SPIN_US) : MAX(ttld.wait_spin_us / 2, 1);
+
+    while (!reached && (now_tsc = __rdtsc()) < end_tsc) {
+        uint32_t seq = atomic_load(&ttld.tdata->wake_seq);
+        if (tasvir_park(d, version)) {
+            uint64_t left_us = tasvir_tsc2usec(end_tsc - now_tsc) + 1;
+            struct timespec ts = {.tv_sec = left_us / S2US, .tv_nsec = left_us % S2US * 1000};
+            syscall(SYS_futex, &ttld.tdata->wake_seq, FUTEX_WAIT, seq, &ts, NULL, 0);
+        }
+        tasvir_service();
+        reached = d->h->version >= version;
+    }
+    return reached ? 0 : -1;
+}
+
+/* forward the wakeups of the tasvir thread of this process to its eventfd */
+static void *tasvir_wait_notifier(void *arg) {
+    tasvir_local_tdata *tdata = arg;
+    const uint64_t one = 1;
+    while (true) {
+        syscall(SYS_futex, &tdata->wake_seq, FUTEX_WAIT, ttld.wait_seq, NULL, NULL, 0);
+        uint32_t seq = atomic_load(&tdata->wake_seq);
+        if (seq != ttld.wait_seq && write(ttld.wait_fd, &one, sizeof(one)) != sizeof(one))
+            LOG_ERR("failed to signal the wait eventfd (%s)", strerror(errno));
+        ttld.wait_seq = seq;
+    }
+    return NULL;
+}
+
+int tasvir_wait_version_fd(const tasvir_area_desc *d, uint64_t version) {
+    if (!ttld.wait_init) {
+        pthread_t notifier;
+        ttld.wait_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        ttld.wait_seq = atomic_load(&ttld.tdata->wake_seq);
+        if (ttld.wait_fd == -1 || pthread_create(&notifier, NULL, tasvir_wait_notifier, ttld.tdata)) {
+            LOG_ERR("failed to set up the wait eventfd (%s)", strerror(errno));
+            if (ttld.wait_fd != -1)
+                close(ttld.wait_fd);
+            return -1;
+        }
+        pthread_detach(notifier);
+        ttld.wait_init = true;
+    }
+    if (!tasvir_park(d, version))
+        tasvir_wake(ttld.tdata);
+    return ttld.wait_fd;
+}
+
 int tasvir_service() {
+    tasvir_unpark();
+
     /* upadte check-in time */
     ttld.tdata->time_us = tasvir_time_us();  // FIXME: assuming invariant tsc
 
+    /* staged writes must reach the log before any sync */
+    if (ttld.nr_log_batch)
+        tasvir_log_flush();
+
     /* service internal rings and NIC ports */
     tasvir_service_io();
 
@@ -119,18 +246,27 @@ int tasvir_service() {
     if (!tasvir_is_running())
         return -1;
 
+    int retval = -1;
+    if (tasvir_sync_epoch()) {
+        retval = 0;
+#ifdef TASVIR_DAEMON
+        /* process memory updates held back until the previous update was published */
+        tasvir_service_ring(ttld.ndata->ring_mem_pending, false);
+#endif
+    }
+
 #ifdef TASVIR_DAEMON
     if (ttld.ndata->stat_reset_req)
         tasvir_stats_reset();
 
     tasvir_service_nodes();
 
-    if (ttld.ndata->sync_req || ttld.ndata->time_us - ttld.ndata->last_sync_int_end >= ttld.ndata->sync_int_us)
+    if (ttld.ndata->sync_req || ttld.ndata->time_us >= ttld.ndata->sync_int_due_us)
         tasvir_sched_sync_internal();
 #endif
 
     if (ttld.tdata->next_sync_seq != ttld.tdata->prev_sync_seq) {
-        int retval = tasvir_sync_internal();
+        retval = tasvir_sync_internal();
 #ifdef TASVIR_DAEMON
         if (!retval) /* process pending memory updates */
             tasvir_service_ring(ttld.ndata->ring_mem_pending, false);
@@ -140,7 +276,10 @@ int tasvir_service() {
 
 #ifdef TASVIR_DAEMON
 #ifndef TASVIR_SYNC_EXT_SKIP
-    if (ttld.ndata->time_us - ttld.ndata->last_sync_ext_end >= ttld.ndata->sync_ext_us)
+    uint64_t sync_ext_us = ttld.ndata->sync_ext_us;
+    if (ttld.ndata->sync_ext_adapt_us)
+        sync_ext_us = MIN(sync_ext_us, ttld.ndata->sync_ext_adapt_us);
+    if (ttld.ndata->time_us - ttld.ndata->last_sync_ext_end >= sync_ext_us)
         tasvir_sync_external();
 #endif
 
@@ -148,15 +287,19 @@ int tasvir_service() {
         tasvir_stats_update();
 #endif
 
-    return -1;
+    return retval;
 }
 
 int tasvir_service_wait(uint64_t timeout_us, bool sync_req) {
-    int retval = -1;
     if (sync_req)
         ttld.ndata->sync_req = true;
     uint64_t end_tsc = __rdtsc() + tasvir_usec2tsc(timeout_us);
-    while (__rdtsc() < end_tsc && (retval = tasvir_service()))
+    while (__rdtsc() < end_tsc) {
+        int retval = tasvir_service();
+        /* a requested sync runs one domain per round and this thread may not take part in the last one */
+        if (sync_req ? !ttld.ndata->sync_req && !(atomic_load(&ttld.ndata->sync_int_round) & 1) : !retval)
+            return 0;
         _mm_pause();
-    return retval;
+    }
+    return -1;
 }
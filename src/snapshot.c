@@ -0,0 +1,200 @@
+#include <fcntl.h>
+#include <stdlib.h>
+
+#include "tasvir.h"
+
+/* a pinned version of an area maps the RO copy and replaces each page with the copy saved in its snapshot slot
+ * once the internal sync first overwrites it. pinned areas only change while their readers are parked in
+ * tasvir_service, so readers switch to the saved pages before they could see the new ones.
+ */
+
+static inline uint8_t *tasvir_snapshot_addr(size_t slot, size_t offset) {
+    return (uint8_t *)TASVIR_ADDR_DATA_SNAPSHOT + slot * TASVIR_SIZE_DATA + offset;
+}
+
+static inline size_t tasvir_snapshot_file_offset(size_t slot, size_t offset) {
+    return TASVIR_SIZE_MAP + (TASVIR_NR_SOCKETS + slot) * TASVIR_SIZE_DATA + offset;
+}
+
+static inline size_t tasvir_snapshot_nr_pages(const tasvir_area_desc *d) {
+    return TASVIR_ALIGNX(d->offset_log_end, TASVIR_PAGE_BYTES) / TASVIR_PAGE_BYTES;
+}
+
+/* save the pages of the RO copy that hold [offset, offset + len) into the slots that do not have them yet */
+void tasvir_snapshot_save(uint32_t slots, size_t offset, size_t len) {
+    for (; slots; slots &= slots - 1) {
+        size_t slot = tasvir_ctz32(slots);
+        tasvir_snapshot *s = &ttld.ndata->snapshots[slot];
+        size_t base = (uintptr_t)s->d->h - TASVIR_ADDR_DATA;
+        /* tasks cover whole pages so no other thread overwrites a page while it is being saved */
+        for (size_t p = (offset - base) / TASVIR_PAGE_BYTES; p <= (offset + len - 1 - base) / TASVIR_PAGE_BYTES; p++) {
+            uint64_t bit = 1UL << (p % 64);
+            if (atomic_load_explicit(&s->saved[p / 64], memory_order_relaxed) & bit ||
+                atomic_fetch_or_explicit(&s->saved[p / 64], bit, memory_order_relaxed) & bit)
+                continue;
+            size_t page = base + p * TASVIR_PAGE_BYTES;
+            memcpy(tasvir_snapshot_addr(slot, page), (uint8_t *)TASVIR_ADDR_DATA_RO + page, TASVIR_PAGE_BYTES);
+            atomic_fetch_add_explicit(&s->nr_saved, 1, memory_order_release);
+        }
+    }
+}
+
+/* join the slot that pins version of d or claim a free one; TASVIR_NR_SNAPSHOTS if none is left */
+static size_t tasvir_snapshot_acquire(const tasvir_area_desc *d, uint64_t version) {
+    for (size_t slot = 0; slot < TASVIR_NR_SNAPSHOTS; slot++) {
+        tasvir_snapshot *s = &ttld.ndata->snapshots[slot];
+        size_t n = atomic_load(&s->nr_pins);
+        while (n && atomic_load(&s->d) == d && s->version == version) {
+            if (!atomic_compare_exchange_weak(&s->nr_pins, &n, n + 1))
+                continue;
+            /* the slot may have been released and claimed again in between */
+            if (atomic_load(&s->d) == d && s->version == version)
+                return slot;
+            atomic_fetch_sub(&s->nr_pins, 1);
+            break;
+        }
+    }
+
+    for (size_t slot = 0; slot < TASVIR_NR_SNAPSHOTS; slot++) {
+        tasvir_snapshot *s = &ttld.ndata->snapshots[slot];
+        const tasvir_area_desc *expected = NULL;
+        if (!atomic_compare_exchange_strong(&s->d, &expected, d))
+            continue;
+        s->version = version;
+        atomic_store(&s->nr_saved, 0);
+        /* the header is updated in place at each sync so save it right away */
+        tasvir_snapshot_save(1U << slot, (uintptr_t)d->h - TASVIR_ADDR_DATA, sizeof(tasvir_area_header));
+        atomic_store_explicit(&s->nr_pins, 1, memory_order_release);
+        return slot;
+    }
+    return TASVIR_NR_SNAPSHOTS;
+}
+
+static void tasvir_snapshot_release(size_t slot) {
+    tasvir_snapshot *s = &ttld.ndata->snapshots[slot];
+    if (atomic_fetch_sub(&s->nr_pins, 1) != 1)
+        return;
+    const tasvir_area_desc *d = s->d;
+    size_t base = (uintptr_t)d->h - TASVIR_ADDR_DATA;
+    size_t nr_pages = tasvir_snapshot_nr_pages(d);
+    memset((void *)s->saved, 0, TASVIR_ALIGNX(nr_pages, 64) / CHAR_BIT);
+    /* give the saved pages back */
+    if (fallocate(ttld.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, tasvir_snapshot_file_offset(slot, base),
+                  nr_pages * TASVIR_PAGE_BYTES))
+        LOG_ERR("failed to free the pages of snapshot slot %lu (%s)", slot, strerror(errno));
+    atomic_store(&s->d, NULL);
+}
+
+/* map the pages saved since the last call over the RO pages of pin */
+static void tasvir_snapshot_remap_pin(tasvir_snapshot_map *pin) {
+    tasvir_snapshot *s = &ttld.ndata->snapshots[pin->slot];
+    size_t nr_saved = atomic_load_explicit(&s->nr_saved, memory_order_acquire);
+    if (nr_saved == pin->nr_remapped)
+        return;
+    pin->nr_remapped = nr_saved;
+
+    size_t base = (uintptr_t)s->d->h - TASVIR_ADDR_DATA;
+    size_t nr_words = TASVIR_ALIGNX(tasvir_snapshot_nr_pages(s->d), 64) / 64;
+    for (size_t w = 0; w < nr_words; w++) {
+        uint64_t fresh = atomic_load_explicit(&s->saved[w], memory_order_relaxed) & ~pin->remapped[w];
+        pin->remapped[w] |= fresh;
+        while (fresh) {
+            int first = __builtin_ctzl(fresh);
+            uint64_t rest = ~(fresh >> first);
+            int run = rest ? __builtin_ctzl(rest) : 64 - first;
+            size_t offset = (w * 64 + first) * TASVIR_PAGE_BYTES;
+            void *ret = mmap(pin->h + offset, run * TASVIR_PAGE_BYTES, PROT_READ, MAP_SHARED | MAP_FIXED, ttld.fd,
+                             tasvir_snapshot_file_offset(pin->slot, base + offset));
+            if (ret != pin->h + offset) {
+                LOG_ERR("mmap for snapshot pages failed (request=%p return=%p). aborting...", pin->h + offset, ret);
+                abort();
+            }
+            fresh = run == 64 ? 0 : fresh & ~(((1UL << run) - 1) << first);
+        }
+    }
+}
+
+void tasvir_snapshot_remap() {
+    for (size_t i = 0; i < TASVIR_NR_SNAPSHOTS; i++)
+        if (ttld.pins[i].h)
+            tasvir_snapshot_remap_pin(&ttld.pins[i]);
+}
+
+/* wait for an internal sync that picked its threads before our pin was visible; it overwrites d unsaved */
+static void tasvir_snapshot_settle() {
+    atomic_thread_fence(memory_order_seq_cst);
+    size_t round = atomic_load(&ttld.ndata->sync_int_round);
+    /* a sync that picked this thread copies nothing before we join its barrier */
+    while (round & 1 && atomic_load(&ttld.ndata->sync_int_round) == round &&
+           ttld.tdata->next_sync_seq == ttld.tdata->prev_sync_seq)
+        _mm_pause();
+}
+
+const void *tasvir_snapshot_pin(const tasvir_area_desc *d) {
+    if (!d || !d->h || d->opts & TASVIR_AREA_OPT_EPOCH) {
+        LOG_ERR("only active areas without epochs can be pinned");
+        return NULL;
+    }
+    size_t nr_pages = tasvir_snapshot_nr_pages(d);
+    if (nr_pages > TASVIR_SNAPSHOT_PAGES_MAX) {
+        LOG_ERR("d=%s is too large to pin (%lu bytes)", d->name, d->offset_log_end);
+        return NULL;
+    }
+    tasvir_snapshot_map *pin = ttld.pins;
+    while (pin < &ttld.pins[TASVIR_NR_SNAPSHOTS] && pin->h)
+        pin++;
+    if (pin == &ttld.pins[TASVIR_NR_SNAPSHOTS]) {
+        LOG_ERR("this thread already holds %d pins", TASVIR_NR_SNAPSHOTS);
+        return NULL;
+    }
+
+    /* take part in the syncs of d from now on so that its RO copy never changes while we are reading it */
+    size_t bit = tasvir_area_filter_bit(d);
+    ttld.tdata->areas_filter[bit / 64] |= 1UL << (bit % 64);
+
+    const tasvir_area_header *h_ro = tasvir_data2ro(d->h);
+    for (;;) {
+        uint64_t version = h_ro->version;
+        pin->slot = tasvir_snapshot_acquire(d, version);
+        if (pin->slot == TASVIR_NR_SNAPSHOTS) {
+            LOG_ERR("all %d snapshot slots are taken", TASVIR_NR_SNAPSHOTS);
+            return NULL;
+        }
+        /* a sync in flight may have torn the copy we saved; it publishes a new version if it touched d */
+        tasvir_snapshot_settle();
+        if (h_ro->version == version)
+            break;
+        tasvir_snapshot_release(pin->slot);
+    }
+    pin->remapped = calloc(TASVIR_ALIGNX(nr_pages, 64) / 64, sizeof(uint64_t));
+    void *h =
+        mmap(NULL, nr_pages * TASVIR_PAGE_BYTES, PROT_READ, MAP_SHARED, ttld.fd, (uintptr_t)d->h - TASVIR_ADDR_BASE);
+    if (!pin->remapped || h == MAP_FAILED) {
+        LOG_ERR("failed to map a snapshot of d=%s (%s)", d->name, strerror(errno));
+        if (h != MAP_FAILED)
+            munmap(h, nr_pages * TASVIR_PAGE_BYTES);
+        free(pin->remapped);
+        tasvir_snapshot_release(pin->slot);
+        return NULL;
+    }
+    pin->h = h;
+    pin->nr_remapped = 0;
+    ttld.nr_pins++;
+    tasvir_snapshot_remap_pin(pin);
+    return (const tasvir_area_header *)pin->h + 1;
+}
+
+void tasvir_snapshot_unpin(const void *data) {
+    for (size_t i = 0; i < TASVIR_NR_SNAPSHOTS; i++) {
+        tasvir_snapshot_map *pin = &ttld.pins[i];
+        if (!pin->h || (const tasvir_area_header *)pin->h + 1 != data)
+            continue;
+        munmap(pin->h, tasvir_snapshot_nr_pages(ttld.ndata->snapshots[pin->slot].d) * TASVIR_PAGE_BYTES);
+        free(pin->remapped);
+        tasvir_snapshot_release(pin->slot);
+        pin->h = NULL;
+        ttld.nr_pins--;
+        return;
+    }
+    LOG_ERR("no snapshot pinned at %p", data);
+}
@@ -38,32 +38,64 @@ void tasvir_stats_update() {
     struct rte_eth_stats s;
     rte_eth_stats_get(0, &s);
 
+    /* time for the pairs, caches, sockets and the node to gather in the barrier */
+    TASVIR_STATIC_ASSERT(TASVIR_BARRIER_LEVELS == 4, "stats print one barrier time per level");
+    uint64_t barrier_level_us[TASVIR_BARRIER_LEVELS];
+    for (int level = 0; level < TASVIR_BARRIER_LEVELS; level++) {
+        barrier_level_us[level] = cur->isync_success > 0 ? cur->isync_barrier_level_us[level] / cur->isync_success : 0;
+        avg->isync_barrier_level_us[level] += cur->isync_barrier_level_us[level];
+    }
+
     LOG_INFO(
-        "isync_cnt=+%lu/s,-%lu/s isync_t=%.1f%%,%luus/call "
-        "isync_changed=%luKB/s,%luKB/call isync_processed=%luKB/s,%luKB/call"
+        "isync_cnt=+%lu/s,-%lu/s isync_t=%.1f%%,%luus/call isync_barrier=%lu/%lu/%lu/%luus/call "
+        "isync_changed=%luKB/s,%luKB/call isync_processed=%luKB/s,%luKB/call isync_suppressed=%luKB/s"
         "\n                                        "
         "esync_cnt=%lu/s esync_t=%.1f%%,%luus/call "
-        "esync_changed=%luKB/s,%luKB/call esync_processed=%luKB/s,%luKB/call"
+        "esync_changed=%luKB/s,%luKB/call esync_processed=%luKB/s,%luKB/call esync_wire=%luKB/s,%.2fx "
+        "esync_lost=%lu/s esync_resent=%lu/s"
         "\n                                        "
         "rx=%luKB/s,%luKpps tx=%luKB/s,%luKpps "
         "(ipkts=%lu ibytes=%lu ierr=%lu imiss=%lu inombuf=%lu"
-        ",opkts=%lu obytes=%lu oerr=%lu)",
+        ",opkts=%lu obytes=%lu oerr=%lu)"
+        "\n                                        "
+        "self_sync<%luKB log_prefetch<%luKB task=%luKB,>=%luKB tasks_per_thread=%lu",
         S2US * cur->isync_success / interval_us, S2US * cur->isync_failure / interval_us,
         100. * cur->isync_us / interval_us, cur->isync_success > 0 ? cur->isync_us / cur->isync_success : 0,
+        barrier_level_us[0], barrier_level_us[1], barrier_level_us[2], barrier_level_us[3],
         MS2US * cur->isync_changed_bytes / interval_us,
         cur->isync_success > 0 ? cur->isync_changed_bytes / 1000 / cur->isync_success : 0,
         MS2US * cur->isync_processed_bytes / interval_us,
         cur->isync_success > 0 ? cur->isync_processed_bytes / 1000 / cur->isync_success : 0,
+        MS2US * cur->isync_suppressed_bytes / interval_us,
 
         S2US * cur->esync_cnt / interval_us, 100. * cur->esync_us / interval_us,
         cur->esync_cnt > 0 ? cur->esync_us / cur->esync_cnt : 0, MS2US * cur->esync_changed_bytes / interval_us,
         cur->esync_cnt > 0 ? cur->esync_changed_bytes / 1000 / cur->esync_cnt : 0,
         MS2US * cur->esync_processed_bytes / interval_us,
         cur->esync_cnt > 0 ? cur->esync_processed_bytes / 1000 / cur->esync_cnt : 0,
+        MS2US * cur->esync_wire_bytes / interval_us,
+        cur->esync_wire_bytes > 0 ? (double)cur->esync_changed_bytes / cur->esync_wire_bytes : 1.,
+        S2US * cur->esync_lost / interval_us, S2US * cur->esync_resent / interval_us,
 
         MS2US * cur->rx_bytes / interval_us, MS2US * cur->rx_pkts / interval_us, MS2US * cur->tx_bytes / interval_us,
         MS2US * cur->tx_pkts / interval_us, s.ipackets, s.ibytes, s.ierrors, s.imissed, s.rx_nombuf, s.opackets,
-        s.obytes, s.oerrors);
+        s.obytes, s.oerrors, ttld.ndata->self_sync_bytes >> 10, ttld.ndata->log_prefetch_bytes >> 10,
+        ttld.ndata->job_bytes >> 10, ttld.ndata->task_bytes_min >> 10, ttld.ndata->tasks_per_thread);
+    avg->sync_int_us_min = avg->sync_ext_us_min = UINT64_MAX;
+    avg->sync_int_us_max = avg->sync_ext_us_max = 0;
+    for (size_t i = 0; i < TASVIR_NR_AREAS; i++) {
+        const tasvir_sync_ctl *ctl = &ttld.ndata->sync_ctl[i];
+        if (!ctl->d || !ctl->d->sync_overhead_pct)
+            continue;
+        LOG_INFO("d=%s sync_int=%luus sync_ext=%luus changed=%.0fKB/s", ctl->d->name, ctl->int_us, ctl->ext_us,
+                 ctl->rate * MS2US);
+        avg->sync_int_us_min = MIN(avg->sync_int_us_min, ctl->int_us);
+        avg->sync_int_us_max = MAX(avg->sync_int_us_max, ctl->int_us);
+        avg->sync_ext_us_min = MIN(avg->sync_ext_us_min, ctl->ext_us);
+        avg->sync_ext_us_max = MAX(avg->sync_ext_us_max, ctl->ext_us);
+    }
+    if (avg->sync_int_us_min == UINT64_MAX)
+        avg->sync_int_us_min = avg->sync_ext_us_min = 0;
 
     avg->isync_success += cur->isync_success;
     avg->isync_failure += cur->isync_failure;
@@ -71,10 +103,14 @@ void tasvir_stats_update() {
     avg->isync_us += cur->isync_us;
     avg->isync_changed_bytes += cur->isync_changed_bytes;
     avg->isync_processed_bytes += cur->isync_processed_bytes;
+    avg->isync_suppressed_bytes += cur->isync_suppressed_bytes;
     avg->esync_cnt += cur->esync_cnt;
     avg->esync_us += cur->esync_us;
     avg->esync_changed_bytes += cur->esync_changed_bytes;
     avg->esync_processed_bytes += cur->esync_processed_bytes;
+    avg->esync_wire_bytes += cur->esync_wire_bytes;
+    avg->esync_lost += cur->esync_lost;
+    avg->esync_resent += cur->esync_resent;
     avg->rx_bytes += cur->rx_bytes;
     avg->rx_pkts += cur->rx_pkts;
     avg->tx_bytes += cur->rx_bytes;
@@ -10,28 +10,21 @@ static void tasvir_msg_mem_generate(const tasvir_area_desc *__restrict d, void *
 
     size_t i = 0;
     tasvir_area_header *h_ro = (tasvir_area_header *)tasvir_data2ro(d->h);
-    uint64_t prev_bytes = h_ro->last_sync_ext_bytes_;
-    uint64_t v = h_ro->version;
+    uint64_t v = ((tasvir_area_header *)tasvir_data2pub(d, d->h))->version;
     while (len > 0) {
-        m[i]->h.dst_tid = ttld.ndata->memcast_tid;
-        m[i]->h.src_tid = ttld.thread->tid;
-        m[i]->h.id = ttld.nr_msgs++ % TASVIR_NR_RPC_MSG;
-        m[i]->h.type = TASVIR_MSG_TYPE_MEM;
-        m[i]->h.d = d;
-        m[i]->h.version = v;
-        m[i]->addr = addr;
-        m[i]->len = MIN(TASVIR_CACHELINE_BYTES * TASVIR_NR_CACHELINES_PER_MSG, len);
-        m[i]->prev_bytes = prev_bytes;
-        m[i]->h.mbuf.pkt_len = m[i]->h.mbuf.data_len =
-            m[i]->len + offsetof(tasvir_msg_mem, line) - offsetof(tasvir_msg, eh);
-        tasvir_stream_vec_rep(m[i]->line, tasvir_data2ro(addr), m[i]->len);
-
-        prev_bytes += m[i]->len;
-
-        addr = (uint8_t *)addr + m[i]->len;
-        len -= m[i]->len;
-        m[i]->last = last && len == 0;
-        tasvir_populate_msg_nethdr((tasvir_msg *)m[i]);
+        /* keep a record of the message to send it again if a subscriber misses it */
+        tasvir_ext_frame *f = &ttld.ndata->ext_frames[ttld.ndata->nr_ext_frames++ % TASVIR_NR_EXT_FRAMES];
+        f->d = d;
+        f->version = v;
+        f->addr = addr;
+        f->len = MIN(d->opts & TASVIR_AREA_OPT_COMPRESS ? TASVIR_MSG_MEM_ENC_MAX : ttld.ndata->msg_mem_bytes, len);
+        f->seq = h_ro->last_sync_ext_seq_++;
+        f->last = false; /* known once the message is filled */
+        f->len = tasvir_msg_mem_populate(m[i], f);
+        addr = (uint8_t *)addr + f->len;
+        len -= f->len;
+        f->last = last && len == 0;
+        m[i]->last = f->last;
 
 #ifdef TASVIR_DEBUG_PRINT_MSG_MEM
         char msg_str[256];
@@ -49,7 +42,6 @@ static void tasvir_msg_mem_generate(const tasvir_area_desc *__restrict d, void *
             i = 0;
         }
     }
-    h_ro->last_sync_ext_bytes_ = prev_bytes;
 
     while (i && rte_ring_sp_enqueue_bulk(ttld.ndata->ring_ext_tx, (void **)m, i, NULL) != i)
         tasvir_service_port_tx();
@@ -61,8 +53,8 @@ size_t tasvir_sync_process_changes(const tasvir_area_desc *d __attribute__((unus
                                    bool external __attribute__((unused))) {
     tasvir_sync_list *__restrict l = &ttld.tdata->sync_list;
     for (int i = 0; i < l->cnt; i++) {
-        size_t offset = l->l[i].offset_scaled << TASVIR_SHIFT_BIT;
-        size_t len = l->l[i].len_scaled << TASVIR_SHIFT_BIT;
+        size_t offset = l->l[i].offset;
+        size_t len = l->l[i].len;
 #ifdef TASVIR_DAEMON
         if (external) {
             uint8_t *src = (uint8_t *)TASVIR_ADDR_DATA + offset;
@@ -70,9 +62,15 @@ size_t tasvir_sync_process_changes(const tasvir_area_desc *d __attribute__((unus
         } else
 #endif
         {
-            uint8_t *dst = (uint8_t *)TASVIR_ADDR_DATA_RO + offset;
-            const uint8_t *src = (uint8_t *)TASVIR_ADDR_DATA_RW + offset;
-            tasvir_store_vec_rep(dst, src, len);
+            /* copying whole vectors is harmless for ranges finer than a vector since writers are quiescent */
+            size_t offset_vec = offset & ~(TASVIR_VEC_BYTES - 1);
+            uint8_t *dst = (uint8_t *)(l->to_spare ? TASVIR_ADDR_DATA_SPARE : TASVIR_ADDR_DATA_RO) + offset_vec;
+            const uint8_t *src = (uint8_t *)TASVIR_ADDR_DATA_RW + offset_vec;
+            if (l->snapshots && !l->to_spare)
+                tasvir_snapshot_save(l->snapshots, offset_vec, offset + len - offset_vec);
+            tasvir_copy_vec_rep(dst, src, offset + len - offset_vec);
+            for (int socket = 1; socket < TASVIR_NR_SOCKETS && l->to_replicas; socket++)
+                tasvir_copy_vec_rep(tasvir_data2replica(dst, socket), src, offset + len - offset_vec);
         }
         l->changed += len;
     }
@@ -83,57 +81,188 @@ size_t tasvir_sync_process_changes(const tasvir_area_desc *d __attribute__((unus
     return bytes_changed;
 }
 
-size_t tasvir_sync_parse_log(const tasvir_area_desc *__restrict d, size_t offset, size_t len, int pivot) {
-    assert(offset % (1 << TASVIR_SHIFT_UNIT) == 0);
+/* number of log bits set in log chunks [c, c_end) */
+TASVIR_INLINE size_t tasvir_sync_count_log(const tasvir_log_t *__restrict log, const tasvir_log_t *__restrict summary,
+                                           size_t summary_base, size_t c, size_t c_end) {
+    const size_t chunk_units = 1 << (TASVIR_SHIFT_SUMMARY - TASVIR_SHIFT_UNIT);
+    size_t n = 0;
+    for (; c < c_end; c++) {
+        c = tasvir_log_summary_next(summary, summary_base + c, summary_base + c_end) - summary_base;
+        if (c >= c_end)
+            break;
+        for (size_t i = 0; i < chunk_units; i++)
+            n += __builtin_popcountl(log[c * chunk_units + i]);
+    }
+    return n;
+}
+
+/* drop from log_val the granules of log chunk c of d that the RO copy already holds and count their bytes */
+TASVIR_INLINE void tasvir_sync_compare(const tasvir_area_desc *__restrict d, size_t c, int shift,
+                                       tasvir_log_vec *__restrict log_val, size_t *__restrict suppressed) {
+    size_t granule = 1UL << shift;
+    size_t base = (uintptr_t)d->h - TASVIR_ADDR_DATA + (c << (shift + TASVIR_SHIFT_SUMMARY - TASVIR_SHIFT_BIT));
+    for (size_t i = 0; i < sizeof(*log_val) / sizeof((*log_val)[0]); i++) {
+        for (tasvir_log_t bits = (*log_val)[i]; bits; bits &= bits - 1) {
+            int b = __builtin_ctzl(bits);
+            size_t offset = base + ((i * TASVIR_LOG_UNIT_BITS + TASVIR_LOG_UNIT_BITS - 1 - b) << shift);
+            const uint8_t *rw = (const uint8_t *)TASVIR_ADDR_DATA_RW + offset;
+            const uint8_t *ro = (const uint8_t *)TASVIR_ADDR_DATA_RO + offset;
+            bool same;
+            if (granule < sizeof(tasvir_log_vec)) {
+                same = !memcmp(rw, ro, granule);
+            } else {
+                tasvir_log_vec diff = {0};
+                for (size_t x = 0; x < granule; x += sizeof(tasvir_log_vec))
+                    diff |= *(const tasvir_log_vec *)(rw + x) ^ *(const tasvir_log_vec *)(ro + x);
+                same = tasvir_log_vec_is_zero(&diff);
+            }
+            if (same) {
+                (*log_val)[i] &= ~(1UL << b);
+                *suppressed += granule;
+            }
+        }
+    }
+}
+
+TASVIR_INLINE size_t tasvir_sync_parse_log_impl(const tasvir_area_desc *__restrict d, size_t offset, size_t len,
+                                                int pivot) {
+    int shift = tasvir_area_log_shift(d);
+    int chunk_shift = shift + TASVIR_SHIFT_SUMMARY - TASVIR_SHIFT_BIT; /* data bytes covered by a log cacheline */
+    assert(offset % (1UL << chunk_shift) == 0);
+    assert(len % (1UL << chunk_shift) == 0);
     tasvir_sync_list *__restrict sync_l = &ttld.tdata->sync_list;
 
 #ifdef TASVIR_DAEMON
     bool external = pivot;  // internal sync iff pivot == 0
     if (external && d == ttld.root_desc) {
         /* copy root desc unconditionally as it is not properly covered by log (orphan) */
-        sync_l->l[sync_l->cnt].offset_scaled = ((uintptr_t)d - TASVIR_ADDR_DATA) >> TASVIR_SHIFT_BIT;
-        sync_l->l[sync_l->cnt].len_scaled =
-            TASVIR_ALIGNX(sizeof(tasvir_area_desc), (1 << TASVIR_SHIFT_BIT)) >> TASVIR_SHIFT_BIT;
+        sync_l->l[sync_l->cnt].offset = (uintptr_t)d - TASVIR_ADDR_DATA;
+        sync_l->l[sync_l->cnt].len = TASVIR_ALIGNX(sizeof(tasvir_area_desc), TASVIR_CACHELINE_BYTES);
         sync_l->cnt++;
     }
 #else
     bool external = false;
     pivot = 0;
 #endif
-    const __m512i zero_v = _mm512_setzero_si512();
     size_t lbits[2] = {0}; /* number of log bits set to 0 and 1 since last batch of ones */
     size_t lbits1_total = 0;
-    size_t offset_scaled = ((uintptr_t)d->h + offset - TASVIR_ADDR_DATA) >> TASVIR_SHIFT_BIT;
-    size_t log_unit_start = offset >> TASVIR_SHIFT_UNIT;
-    size_t log_units = len >> TASVIR_SHIFT_UNIT;
-    tasvir_log_t *__restrict log = external ? d->h->diff_log[0].data : tasvir_data2log(d->h);
+    size_t offset_scaled = ((uintptr_t)d->h + offset - TASVIR_ADDR_DATA) >> shift;
+    const tasvir_area_log *__restrict from_log = external ? &d->h->diff_log[0] : sync_l->from_log;
+    tasvir_log_t *__restrict log = from_log ? from_log->data : tasvir_data2log(d->h);
     tasvir_log_t *__restrict log_internal = tasvir_area_is_local(d) ? d->h->diff_log[external].data : NULL;
+    bool keep_log = sync_l->from_log && !external;
+
+    /* walk only the log cachelines whose summary bit is set in any of the logs being parsed */
+    tasvir_log_t *__restrict summary = from_log ? from_log->summary : (tasvir_log_t *)TASVIR_ADDR_LOG_SUMMARY;
+    size_t summary_base = from_log ? 0 : tasvir_data2summarybit((uintptr_t)d->h);
+    size_t chunk_start = offset >> chunk_shift;
+    size_t chunk_end = (offset + len) >> chunk_shift;
+    const size_t chunk_bits = 1 << (TASVIR_SHIFT_SUMMARY - TASVIR_SHIFT_BIT);
+    const size_t chunk_units = chunk_bits / TASVIR_LOG_UNIT_BITS;
+    TASVIR_STATIC_ASSERT(TASVIR_SHIFT_SUMMARY - TASVIR_SHIFT_BYTE == __TASVIR_LOG2(sizeof(tasvir_log_vec)),
+                         "each summary bit must cover one vector of log units");
+
+    /* a region where most lines changed is copied whole since one long copy beats many short ones. only plain
+     * internal syncs do so: everything unlogged there is the same in both copies. the first region holds the header.
+     * areas that compare lines before copying them keep to the lines that changed.
+     */
+    bool compare = !external && !from_log && d->opts & TASVIR_AREA_OPT_COMPARE;
+    bool copy_dense = !external && !from_log && !compare;
+    size_t region_chunks = MAX(TASVIR_SYNC_REGION_BYTES >> chunk_shift, 1);
+    size_t region_end = chunk_start;
 
-    for (size_t li = log_unit_start; li < log_unit_start + log_units; li += 8) {
-        __m512i log_val_v = _mm512_load_si512((__m512i *)&log[li]);
+    for (size_t c = chunk_start, c_next; c < chunk_end; c = c_next + 1) {
+        c_next = tasvir_log_summary_next(summary, summary_base + c, summary_base + chunk_end) - summary_base;
+        for (int p = 1; p < pivot; p++)
+            c_next = tasvir_log_summary_next(d->h->diff_log[p].summary, c, c_next);
+        lbits[0] += (c_next - c) * chunk_bits;
+        if (c_next >= chunk_end)
+            break;
+
+        if (copy_dense && c_next >= region_end) {
+            region_end = MIN((c_next | (region_chunks - 1)) + 1, chunk_end);
+            size_t nr_dense = c_next ? tasvir_sync_count_log(log, summary, summary_base, c_next, region_end) : 0;
+            size_t region_bits = (region_end - c_next) * chunk_bits;
+            if (nr_dense * 100 >= region_bits * TASVIR_SYNC_DENSE_PCT) {
+                /* copy the pending batch of ones and then the rest of the region */
+                sync_l->l[sync_l->cnt].offset = offset_scaled << shift;
+                sync_l->l[sync_l->cnt].len = lbits[1] << shift;
+                sync_l->cnt += (bool)lbits[1];
+                offset_scaled += lbits[0] + lbits[1];
+                lbits1_total += lbits[1] + nr_dense;
+                lbits[0] = 0;
+                lbits[1] = 0;
+                sync_l->l[sync_l->cnt].offset = offset_scaled << shift;
+                sync_l->l[sync_l->cnt].len = region_bits << shift;
+                sync_l->cnt++;
+                sync_l->changed -= (int)((region_bits - nr_dense) << shift); /* the unchanged lines do not count */
+                offset_scaled += region_bits;
+
+                for (size_t c_dense = c_next; c_dense < region_end; c_dense++) {
+                    c_dense = tasvir_log_summary_next(summary, summary_base + c_dense, summary_base + region_end) -
+                              summary_base;
+                    if (c_dense >= region_end)
+                        break;
+                    tasvir_log_vec *log_val = (tasvir_log_vec *)&log[c_dense * chunk_units];
+                    if (log_internal && !tasvir_log_vec_is_zero(log_val)) {
+                        *(tasvir_log_vec *)&log_internal[c_dense * chunk_units] |= *log_val;
+                        tasvir_log_summary_set(d->h->diff_log[external].summary, c_dense, c_dense);
+                    }
+                    *log_val = (tasvir_log_vec){0};
+                }
+                c_next = region_end - 1;
+                if (sync_l->cnt >= TASVIR_SYNC_LIST_LEN / 2)
+                    tasvir_sync_process_changes(d, false, external);
+                continue;
+            }
+        }
+
+        size_t li = c_next * chunk_units;
+        tasvir_log_vec log_val_v = *(tasvir_log_vec *)&log[li];
         for (int p = 1; p < pivot; p++) {
-            log_val_v = _mm512_or_si512(log_val_v, *(__m512i *)&d->h->diff_log[p].data[li]);
+            log_val_v |= *(tasvir_log_vec *)&d->h->diff_log[p].data[li];
             if (p == 1) /* update the internal log */
-                _mm512_store_epi64((__m512i *)&log_internal[li], log_val_v);
+                *(tasvir_log_vec *)&log_internal[li] = log_val_v;
+        }
+        if (compare && !tasvir_log_vec_is_zero(&log_val_v)) {
+            /* the unchanged lines must not reach the internal log either, or external sync would send them */
+            *(tasvir_log_vec *)&log[li] = (tasvir_log_vec){0};
+            tasvir_sync_compare(d, c_next, shift, &log_val_v, &sync_l->suppressed);
         }
 
-        __mmask16 one_mask = _mm512_test_epi64_mask(log_val_v, log_val_v);
-        if (!one_mask) { /* skip zero log units */
-            lbits[0] += 8 * TASVIR_LOG_UNIT_BITS;
+        if (tasvir_log_vec_is_zero(&log_val_v)) { /* skip zero log units */
+            lbits[0] += chunk_bits;
             continue;
         }
 
-        if (log_internal && pivot < 2) /* update the internal log */
-            _mm512_store_epi64((__m512i *)&log_internal[li], _mm512_or_si512(log_val_v, *(__m512i *)&log_internal[li]));
+        if (log_internal) {
+            if (pivot < 2) /* update the internal log */
+                *(tasvir_log_vec *)&log_internal[li] |= log_val_v;
+            tasvir_log_summary_set(d->h->diff_log[external].summary, c_next, c_next);
+        }
 
         tasvir_log_t log_val_i[8];
-        _mm512_store_epi64(log_val_i, log_val_v);
-        _mm512_store_epi64((__m512i *)&log[li], zero_v); /* clear out the log */
+        uint32_t one_mask = 0;
+        for (int i = 0; i < 8; i++) {
+            log_val_i[i] = log_val_v[i];
+            one_mask |= (uint32_t)(log_val_i[i] != 0) << i;
+        }
+        if (!keep_log)
+            *(tasvir_log_vec *)&log[li] = (tasvir_log_vec){0}; /* clear out the log */
+
+        if (li == 0 && shift > TASVIR_SHIFT_BIT && log_val_i[0] >> (TASVIR_LOG_UNIT_BITS - 1)) {
+            /* the first granule holds the local part of the header which must never be copied */
+            log_val_i[0] &= ~(tasvir_log_t)0 >> 1;
+            sync_l->l[sync_l->cnt].offset = (uintptr_t)d->h - TASVIR_ADDR_DATA + sizeof(d->h->pad_);
+            sync_l->l[sync_l->cnt].len = (1UL << shift) - sizeof(d->h->pad_);
+            sync_l->cnt++;
+            lbits1_total++;
+        }
 
         /* removes the need to handle the case of last batch being all zeros */
         one_mask |= 1 << 8;
         for (int i = 0; i < 8; i++) {
-            uint8_t zcnt = _tzcnt_u32(one_mask >> i);
+            uint8_t zcnt = tasvir_ctz32(one_mask >> i);
             if (zcnt) { /* skip zero log units */
                 i += zcnt - 1;
                 lbits[0] += zcnt * TASVIR_LOG_UNIT_BITS;
@@ -146,15 +275,16 @@ size_t tasvir_sync_parse_log(const tasvir_area_desc *__restrict d, size_t offset
             do {
                 if (is_leading_bit_set && lbits[0]) {
                     if (lbits[1]) {
-                        uint8_t *dst = (uint8_t *)TASVIR_ADDR_DATA_RO + ((offset_scaled) << TASVIR_SHIFT_BIT);
-                        _mm_prefetch(dst + TASVIR_OFFSET_RO2RW, _MM_HINT_T0);
+                        uint8_t *dst = (uint8_t *)(sync_l->to_spare ? TASVIR_ADDR_DATA_SPARE : TASVIR_ADDR_DATA_RO) +
+                                       (offset_scaled << shift);
+                        _mm_prefetch((uint8_t *)TASVIR_ADDR_DATA_RW + (offset_scaled << shift), _MM_HINT_T0);
                         _mm_prefetch(dst, _MM_HINT_T1);
                     }
 
                     /* NOTE: doing possibly redundant work to avoid branching */
                     /* copy for the previous batch of ones */
-                    sync_l->l[sync_l->cnt].offset_scaled = offset_scaled;
-                    sync_l->l[sync_l->cnt].len_scaled = lbits[1];
+                    sync_l->l[sync_l->cnt].offset = offset_scaled << shift;
+                    sync_l->l[sync_l->cnt].len = lbits[1] << shift;
                     /* only if there actually was any change */
                     sync_l->cnt += (bool)lbits[1];
                     /* move the pointers to the head of current batch of ones */
@@ -163,7 +293,7 @@ size_t tasvir_sync_parse_log(const tasvir_area_desc *__restrict d, size_t offset
                     lbits[0] = 0;
                     lbits[1] = 0;
                 }
-                uint8_t lbits_same = _lzcnt_u64(is_leading_bit_set ? ~log_val_i[i] : log_val_i[i]);
+                uint8_t lbits_same = tasvir_clz64(is_leading_bit_set ? ~log_val_i[i] : log_val_i[i]);
                 lbits_same = MIN(lbits_unit_left, lbits_same);
                 lbits[is_leading_bit_set] += lbits_same;
                 lbits_unit_left -= lbits_same;
@@ -177,11 +307,14 @@ size_t tasvir_sync_parse_log(const tasvir_area_desc *__restrict d, size_t offset
             tasvir_sync_process_changes(d, false, external);
     }
 
+    if (chunk_end > chunk_start && !keep_log)
+        tasvir_log_summary_clear(summary, summary_base + chunk_start, summary_base + chunk_end - 1);
+
     /* copy for the last batch of ones */
     if (lbits[1]) {
         lbits1_total += lbits[1];
-        sync_l->l[sync_l->cnt].offset_scaled = offset_scaled;
-        sync_l->l[sync_l->cnt].len_scaled = lbits[1];
+        sync_l->l[sync_l->cnt].offset = offset_scaled << shift;
+        sync_l->l[sync_l->cnt].len = lbits[1] << shift;
         sync_l->cnt++;
     }
     if (external && lbits1_total) {
@@ -190,5 +323,9 @@ size_t tasvir_sync_parse_log(const tasvir_area_desc *__restrict d, size_t offset
         d->h->diff_log[1].end_us = d->h->diff_log[0].start_us = d->h->diff_log[0].end_us;
     }
 
-    return lbits1_total << TASVIR_SHIFT_BIT;
+    return lbits1_total << shift;
 }
+
+TASVIR_ISA_DISPATCH(, size_t, tasvir_sync_parse_log,
+                    (const tasvir_area_desc *__restrict d, size_t offset, size_t len, int pivot),
+                    (d, offset, len, pivot))
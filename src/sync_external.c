@@ -2,12 +2,268 @@
 #include "tasvir.h"
 
 #ifdef TASVIR_DAEMON
+/* loss recovery: memory messages carry their position in the messages of a version. a subscriber that finds some
+ * missing applies the rest, holds back the version and asks the daemon of the writer for the missing ones, which
+ * sends them again as long as the lines they cover did not change since. messages lost at the tail of a version go
+ * unnoticed until the next version arrives.
+ */
+
+/* zero-run encoding of memory messages: the memory is split into groups of up to 8 words. a group with nonzero words
+ * is a byte with a bit per word followed by its nonzero words, and a run of zero groups is a zero byte followed by
+ * the number of groups in the run. numeric fields that are mostly zero take a fraction of their size on the wire.
+ */
+#define TASVIR_ZRLE_GROUP_WORDS 8
+
+static inline bool tasvir_zrle_group_is_zero(const uint64_t *src, size_t nr_words) {
+    uint64_t val = 0;
+    for (size_t i = 0; i < nr_words; i++)
+        val |= src[i];
+    return !val;
+}
+
+/* encode as much of the len bytes of src as fits in cap bytes of dst; returns the bytes of src encoded */
+static size_t tasvir_zrle_encode(uint8_t *__restrict dst, size_t cap, const uint64_t *__restrict src, size_t len,
+                                 size_t *enc_len) {
+    size_t nr_words = len / sizeof(uint64_t);
+    size_t w = 0;
+    size_t out = 0;
+    while (w < nr_words) {
+        size_t n = MIN(TASVIR_ZRLE_GROUP_WORDS, nr_words - w);
+        uint8_t mask = 0;
+        for (size_t i = 0; i < n; i++)
+            mask |= (uint8_t)(src[w + i] != 0) << i;
+        if (!mask) {
+            if (out + 2 > cap)
+                break;
+            size_t run = 1;
+            size_t w_next = w + n;
+            while (run < UINT8_MAX && w_next < nr_words &&
+                   tasvir_zrle_group_is_zero(&src[w_next], MIN(TASVIR_ZRLE_GROUP_WORDS, nr_words - w_next))) {
+                w_next = MIN(w_next + TASVIR_ZRLE_GROUP_WORDS, nr_words);
+                run++;
+            }
+            dst[out++] = 0;
+            dst[out++] = (uint8_t)run;
+            w = w_next;
+            continue;
+        }
+        if (out + 1 + __builtin_popcount(mask) * sizeof(uint64_t) > cap)
+            break;
+        dst[out++] = mask;
+        for (size_t i = 0; i < n; i++) {
+            if (mask & (1 << i)) {
+                memcpy(&dst[out], &src[w + i], sizeof(uint64_t));
+                out += sizeof(uint64_t);
+            }
+        }
+        w += n;
+    }
+    *enc_len = out;
+    return w * sizeof(uint64_t);
+}
+
+/* decode the enc_len bytes of src into the len bytes of dst; false if src ends before dst is complete */
+static bool tasvir_zrle_decode(uint64_t *__restrict dst, size_t len, const uint8_t *__restrict src, size_t enc_len) {
+    size_t nr_words = len / sizeof(uint64_t);
+    size_t w = 0;
+    const uint8_t *src_end = src + enc_len;
+    while (w < nr_words && src < src_end) {
+        uint8_t mask = *src++;
+        if (!mask) {
+            if (src == src_end)
+                return false;
+            size_t run = *src++;
+            size_t w_end = MIN(w + run * TASVIR_ZRLE_GROUP_WORDS, nr_words);
+            memset(&dst[w], 0, (w_end - w) * sizeof(uint64_t));
+            w = w_end;
+            continue;
+        }
+        size_t n = MIN(TASVIR_ZRLE_GROUP_WORDS, nr_words - w);
+        if ((size_t)(src_end - src) < __builtin_popcount(mask & ((1U << n) - 1)) * sizeof(uint64_t))
+            return false;
+        for (size_t i = 0; i < n; i++) {
+            if (mask & (1 << i)) {
+                memcpy(&dst[w + i], src, sizeof(uint64_t));
+                src += sizeof(uint64_t);
+            } else {
+                dst[w + i] = 0;
+            }
+        }
+        w += n;
+    }
+    return w == nr_words;
+}
+
+/* jumbo frames: a memory message keeps the first TASVIR_MSG_MEM_BYTES of its payload in its line and the rest in
+ * mbuf segments chained to it, so a message carries as much as the MTU of the port allows.
+ */
+#define TASVIR_MSG_MEM_BYTES_MAX TASVIR_MSG_MEM_MTU_BYTES(TASVIR_ETH_MTU_MAX)
+#define TASVIR_NR_MSG_SEGS_MAX \
+    (TASVIR_ALIGNX(TASVIR_MSG_MEM_BYTES_MAX - TASVIR_MSG_MEM_BYTES, TASVIR_MSG_SEG_BYTES) / TASVIR_MSG_SEG_BYTES)
+
+/* encoded payloads of messages in multiple segments on their way out or in */
+static tasvir_cacheline tasvir_msg_mem_buf[TASVIR_MSG_MEM_BYTES_MAX / TASVIR_CACHELINE_BYTES];
+
+/* copy the len bytes of src to the payload of m and chain as many of segs as the part past its line takes */
+static void tasvir_msg_mem_write(tasvir_msg_mem *m, struct rte_mbuf **segs, const uint8_t *src, size_t len) {
+    size_t seg_len = MIN(len, TASVIR_MSG_MEM_BYTES);
+    if (src != (const uint8_t *)m->line) /* unless it was encoded in place */
+        tasvir_stream_rep(m->line, src, seg_len);
+    m->h.mbuf.data_len = TASVIR_MSG_MEM_HDR_BYTES + seg_len;
+    struct rte_mbuf *prev = &m->h.mbuf;
+    for (src += seg_len, len -= seg_len; len > 0; src += seg_len, len -= seg_len) {
+        struct rte_mbuf *seg = *segs++;
+        seg_len = MIN(len, TASVIR_MSG_SEG_BYTES);
+        tasvir_stream_rep(rte_pktmbuf_mtod(seg, void *), src, seg_len);
+        seg->data_len = seg_len;
+        prev->next = seg;
+        prev = seg;
+        m->h.mbuf.nb_segs++;
+    }
+}
+
+/* copy the first len bytes of the payload of m to dst, walking the segments the port received it in */
+static void tasvir_msg_mem_read(const tasvir_msg_mem *m, uint8_t *dst, size_t len) {
+    const struct rte_mbuf *seg = &m->h.mbuf;
+    const uint8_t *src = (const uint8_t *)m->line;
+    size_t seg_len = seg->data_len - TASVIR_MSG_MEM_HDR_BYTES;
+    while (true) {
+        seg_len = MIN(seg_len, len);
+        tasvir_stream_rep(dst, src, seg_len);
+        dst += seg_len;
+        len -= seg_len;
+        if (!len || !(seg = seg->next))
+            break;
+        src = rte_pktmbuf_mtod(seg, const uint8_t *);
+        seg_len = seg->data_len;
+    }
+}
+
+/* send a request for the messages [seq_start, seq_end) of version of d to the daemon of its writer */
+static void tasvir_ext_nack(const tasvir_area_desc *d, uint64_t version, uint32_t seq_start, uint32_t seq_end) {
+    tasvir_msg_nack *m;
+    if (!d->owner || rte_mempool_get(ttld.ndata->mp, (void **)&m)) {
+        LOG_DBG("failed to ask for the missing messages of d=%s", d->name);
+        return;
+    }
+    m->h.dst_tid = d->owner->tid;
+    m->h.src_tid = ttld.thread ? ttld.thread->tid : ttld.ndata->boot_tid;
+    m->h.id = ttld.nr_msgs++ % TASVIR_NR_RPC_MSG;
+    m->h.type = TASVIR_MSG_TYPE_MEM_NACK;
+    m->h.d = d;
+    m->h.version = version;
+    m->seq_start = seq_start;
+    m->seq_end = seq_end;
+    m->h.mbuf.pkt_len = m->h.mbuf.data_len = sizeof(tasvir_msg_nack) - offsetof(tasvir_msg, eh);
+    tasvir_populate_msg_nethdr((tasvir_msg *)m);
+    if (rte_ring_sp_enqueue(ttld.ndata->ring_ext_tx, m))
+        rte_mempool_put(ttld.ndata->mp, (void *)m);
+}
+
+/* record the messages [seq_start, seq_end) of version of d as missing; NULL if there is no room */
+static tasvir_ext_gap *tasvir_ext_gap_new(const tasvir_area_desc *d, uint64_t version, uint32_t seq_start,
+                                          uint32_t seq_end) {
+    tasvir_ext_gap *g = ttld.ndata->ext_gaps;
+    while (g < &ttld.ndata->ext_gaps[TASVIR_NR_EXT_GAPS] && g->d)
+        g++;
+    if (g == &ttld.ndata->ext_gaps[TASVIR_NR_EXT_GAPS])
+        return NULL;
+    *g = (tasvir_ext_gap){.d = d, .version = version, .seq_start = seq_start, .seq_end = seq_end};
+    g->nack_us = ttld.ndata->time_us;
+    g->nr_nacks = 1;
+    ttld.ndata->nr_ext_gaps++;
+    return g;
+}
+
+/* forget the missing messages of d */
+static void tasvir_ext_gap_drop(const tasvir_area_desc *d) {
+    for (size_t i = 0; i < TASVIR_NR_EXT_GAPS && ttld.ndata->nr_ext_gaps; i++) {
+        if (ttld.ndata->ext_gaps[i].d == d) {
+            ttld.ndata->ext_gaps[i].d = NULL;
+            ttld.ndata->nr_ext_gaps--;
+        }
+    }
+}
+
+/* mark message seq of d as arrived; false if it was not missing */
+static bool tasvir_ext_gap_fill(const tasvir_area_desc *d, uint32_t seq) {
+    for (size_t i = 0; i < TASVIR_NR_EXT_GAPS && ttld.ndata->nr_ext_gaps; i++) {
+        tasvir_ext_gap *g = &ttld.ndata->ext_gaps[i];
+        if (g->d != d || seq < g->seq_start || seq >= g->seq_end)
+            continue;
+        if (seq == g->seq_start) {
+            g->seq_start++;
+        } else if (seq == g->seq_end - 1) {
+            g->seq_end--;
+        } else {
+            /* with no room to split the gap the message is taken again when the whole gap is sent again */
+            tasvir_ext_gap *g_next = tasvir_ext_gap_new(d, g->version, seq + 1, g->seq_end);
+            if (g_next) {
+                g_next->nack_us = g->nack_us;
+                g_next->nr_nacks = g->nr_nacks;
+                g->seq_end = seq;
+            }
+        }
+        if (g->seq_start == g->seq_end) {
+            g->d = NULL;
+            ttld.ndata->nr_ext_gaps--;
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool tasvir_ext_gap_find(const tasvir_area_desc *d) {
+    for (size_t i = 0; i < TASVIR_NR_EXT_GAPS && ttld.ndata->nr_ext_gaps; i++)
+        if (ttld.ndata->ext_gaps[i].d == d)
+            return true;
+    return false;
+}
+
+/* stop taking messages of the version being received by h_rw until the next one */
+static void tasvir_ext_ignore(const tasvir_area_desc *d, tasvir_area_header *h_rw) {
+    tasvir_ext_gap_drop(d);
+    h_rw->flags_ &= ~TASVIR_AREA_FLAG_EXT_PENDING;
+    h_rw->flags_ |= TASVIR_AREA_FLAG_EXT_IGNORE;
+}
+
+/* all messages of the version being received by h_rw arrived */
+static void tasvir_ext_complete(const tasvir_area_desc *d, tasvir_area_header *h_rw) {
+    bool is_epoch = d->opts & TASVIR_AREA_OPT_EPOCH;
+    h_rw->flags_ &= ~TASVIR_AREA_FLAG_EXT_PENDING;
+    h_rw->flags_ |= TASVIR_AREA_FLAG_ACTIVE;
+    if (tasvir_is_booting()) {
+        tasvir_area_header *h_ro = tasvir_data2ro(d->h);
+        h_ro->flags_ |= TASVIR_AREA_FLAG_ACTIVE;
+        if (is_epoch) {
+            tasvir_area_header *h_spare = tasvir_data2spare(d->h);
+            h_spare->flags_ |= TASVIR_AREA_FLAG_ACTIVE;
+        }
+        for (int socket = 1; socket < TASVIR_NR_SOCKETS && d->opts & TASVIR_AREA_OPT_REPLICATE; socket++) {
+            tasvir_area_header *h_rep = tasvir_data2replica(d->h, socket);
+            h_rep->flags_ |= TASVIR_AREA_FLAG_ACTIVE;
+        }
+    } else if (is_epoch || ttld.ndata->time_us - ttld.ndata->last_sync_int_end > 0.5 * d->sync_int_us) {
+        /* epoch areas are published at our next service, so hold back the next update until then */
+        h_rw->flags_ |= TASVIR_AREA_FLAG_EXT_ENQUEUE;
+    }
+}
+
 void tasvir_handle_msg_mem(tasvir_msg_mem *m) {
-    // FIXME: incoming only. not robust. assumes lossless in-order delivery
+    /* incoming only. messages of a version are expected in sequence order: one that arrives early opens a gap and
+     * sends a NACK that turns out spurious, since the late message then fills its gap through tasvir_ext_gap_fill.
+     * losses at the tail of a version leave no later message to reveal them and go unnoticed until the next version.
+     */
     // TODO: remove the outgoing code from msg_mem_generate and bring it here
     if (!m->h.d->h)
         goto cleanup;
+    /* a message cut short on the way is as good as lost */
+    size_t payload_len = m->enc_len ? m->enc_len : m->addr ? m->len : 0;
+    if (m->h.mbuf.data_len < TASVIR_MSG_MEM_HDR_BYTES || m->h.mbuf.pkt_len < TASVIR_MSG_MEM_HDR_BYTES + payload_len ||
+        m->enc_len > TASVIR_MSG_MEM_BYTES_MAX)
+        goto cleanup;
     tasvir_area_header *h_rw = tasvir_data2rw(m->h.d->h);
+    bool is_epoch = m->h.d->opts & TASVIR_AREA_OPT_EPOCH;
     if (h_rw->flags_ & TASVIR_AREA_FLAG_EXT_ENQUEUE) {
         if (!rte_ring_sp_enqueue(ttld.ndata->ring_mem_pending, m))
             return;
@@ -15,38 +271,74 @@ void tasvir_handle_msg_mem(tasvir_msg_mem *m) {
         h_rw->flags_ |= TASVIR_AREA_FLAG_EXT_IGNORE;
         goto cleanup;
     }
+    /* a message sent again that arrives after the next version started is of no use anymore */
+    if (m->resent && h_rw->last_sync_ext_v_ != m->h.version)
+        goto cleanup;
     if (h_rw->last_sync_ext_v_ != m->h.version) {
+        /* the messages still missing from the previous version will not come anymore */
+        tasvir_ext_gap_drop(m->h.d);
         h_rw->last_sync_ext_v_ = m->h.version;
-        h_rw->last_sync_ext_bytes_ = 0;
-        h_rw->flags_ &= ~TASVIR_AREA_FLAG_EXT_IGNORE;
+        h_rw->last_sync_ext_seq_ = 0;
+        h_rw->flags_ &= ~(TASVIR_AREA_FLAG_EXT_IGNORE | TASVIR_AREA_FLAG_EXT_LAST);
         h_rw->flags_ |= TASVIR_AREA_FLAG_EXT_PENDING;
     }
     if (h_rw->flags_ & TASVIR_AREA_FLAG_EXT_IGNORE || !(h_rw->flags_ & TASVIR_AREA_FLAG_EXT_PENDING)) {
         goto cleanup;
     }
-    if (h_rw->last_sync_ext_bytes_ != m->prev_bytes) {
-        // LOG_ERR("%s missed pkts prev_bytes=%lu vs %lu", m->h.d->name, h_rw->last_sync_ext_bytes_, m->prev_bytes);
-        h_rw->flags_ &= ~TASVIR_AREA_FLAG_EXT_PENDING;
-        h_rw->flags_ |= TASVIR_AREA_FLAG_EXT_IGNORE;
+    if (m->seq < h_rw->last_sync_ext_seq_) {
+        /* a message sent again, or one we already have */
+        if (!tasvir_ext_gap_fill(m->h.d, m->seq))
+            goto cleanup;
+    } else {
+        if (m->seq > h_rw->last_sync_ext_seq_) {
+            ttld.ndata->stats_cur.esync_lost += m->seq - h_rw->last_sync_ext_seq_;
+            if (tasvir_ext_gap_new(m->h.d, m->h.version, h_rw->last_sync_ext_seq_, m->seq)) {
+                tasvir_ext_nack(m->h.d, m->h.version, h_rw->last_sync_ext_seq_, m->seq);
+            } else {
+                LOG_DBG("%s missed messages %lu-%u with no room to track them", m->h.d->name,
+                        h_rw->last_sync_ext_seq_, m->seq - 1);
+                tasvir_ext_ignore(m->h.d, h_rw);
+            }
+        }
+        h_rw->last_sync_ext_seq_ = m->seq + 1;
     }
     if (m->addr) {
-        tasvir_log(m->addr, m->len);
-        tasvir_stream_vec_rep(tasvir_data2rw(m->addr), m->line, m->len);
-        h_rw->last_sync_ext_bytes_ += m->len;
-        /* write to both versions during boot of a non-root daemon because no sync happens */
-        if (tasvir_is_booting())
-            tasvir_stream_vec_rep(tasvir_data2ro(m->addr), m->line, m->len);
-    }
-    if (m->last) {
-        h_rw->flags_ &= ~TASVIR_AREA_FLAG_EXT_PENDING;
-        h_rw->flags_ |= TASVIR_AREA_FLAG_ACTIVE;
+        /* the log map only covers local areas, so log through the descriptor */
+        tasvir_log_area(m->h.d, m->addr, m->len);
+        /* the other copies are made from RW unless the payload is raw and in one piece */
+        const void *line = tasvir_data2rw(m->addr);
+        if (m->enc_len) {
+            const uint8_t *enc = (const uint8_t *)m->line;
+            if (m->h.mbuf.nb_segs > 1) {
+                tasvir_msg_mem_read(m, (uint8_t *)tasvir_msg_mem_buf, m->enc_len);
+                enc = (const uint8_t *)tasvir_msg_mem_buf;
+            }
+            if (!tasvir_zrle_decode(tasvir_data2rw(m->addr), m->len, enc, m->enc_len)) {
+                LOG_DBG("%s got a malformed message %u of version %lu", m->h.d->name, m->seq, m->h.version);
+                tasvir_ext_ignore(m->h.d, h_rw);
+                goto cleanup;
+            }
+        } else if (m->h.mbuf.nb_segs > 1) {
+            tasvir_msg_mem_read(m, tasvir_data2rw(m->addr), m->len);
+        } else {
+            tasvir_stream_rep(tasvir_data2rw(m->addr), m->line, m->len);
+            line = m->line;
+        }
+        /* write to all versions during boot of a non-root daemon because no sync happens */
         if (tasvir_is_booting()) {
-            tasvir_area_header *h_ro = tasvir_data2ro(m->h.d->h);
-            h_ro->flags_ |= TASVIR_AREA_FLAG_ACTIVE;
-        } else if (ttld.ndata->time_us - ttld.ndata->last_sync_int_end > 0.5 * ttld.ndata->sync_int_us) {
-            h_rw->flags_ |= TASVIR_AREA_FLAG_EXT_ENQUEUE;
+            tasvir_stream_rep(tasvir_data2ro(m->addr), line, m->len);
+            if (is_epoch)
+                tasvir_stream_rep(tasvir_data2spare(m->addr), line, m->len);
+            for (int socket = 1; socket < TASVIR_NR_SOCKETS && m->h.d->opts & TASVIR_AREA_OPT_REPLICATE; socket++)
+                tasvir_stream_rep(tasvir_data2replica(m->addr, socket), line, m->len);
         }
     }
+    if (m->last)
+        h_rw->flags_ |= TASVIR_AREA_FLAG_EXT_LAST;
+    /* the version is complete once the last message and every one missing before it arrived */
+    if (h_rw->flags_ & TASVIR_AREA_FLAG_EXT_PENDING && h_rw->flags_ & TASVIR_AREA_FLAG_EXT_LAST &&
+        !tasvir_ext_gap_find(m->h.d))
+        tasvir_ext_complete(m->h.d, h_rw);
 
 #ifdef TASVIR_DEBUG_PRINT_MSG_MEM
     char msg_str[256];
@@ -54,19 +346,185 @@ void tasvir_handle_msg_mem(tasvir_msg_mem *m) {
     LOG_DBG("%s", msg_str);
 #endif
 
+cleanup:
+    rte_pktmbuf_free(&m->h.mbuf);
+}
+
+/* ask again for the messages that did not arrive in time and give up on the versions that keep missing some */
+void tasvir_service_nacks() {
+    for (size_t i = 0; i < TASVIR_NR_EXT_GAPS && ttld.ndata->nr_ext_gaps; i++) {
+        tasvir_ext_gap *g = &ttld.ndata->ext_gaps[i];
+        if (!g->d || ttld.ndata->time_us - g->nack_us < TASVIR_EXT_NACK_US)
+            continue;
+        if (g->nr_nacks >= TASVIR_EXT_NACK_TRIES) {
+            LOG_DBG("%s gave up on messages %u-%u of v=%lu", g->d->name, g->seq_start, g->seq_end - 1, g->version);
+            tasvir_ext_ignore(g->d, tasvir_data2rw(g->d->h));
+            continue;
+        }
+        g->nack_us = ttld.ndata->time_us;
+        g->nr_nacks++;
+        tasvir_ext_nack(g->d, g->version, g->seq_start, g->seq_end);
+    }
+}
+
+/* fill m with the memory message f and return the bytes of memory it covers: f->len for a raw payload, and up to
+ * f->len for areas with TASVIR_AREA_OPT_COMPRESS which use the encoding whenever it covers more or takes less space
+ */
+/* payload of a memory message of d; frames past the MTU of a user would be dropped by its port */
+static size_t tasvir_msg_mem_cap(const tasvir_area_desc *d) {
+    size_t cap = ttld.ndata->msg_mem_bytes;
+    for (size_t i = 0; i < d->h->nr_users; i++) {
+        const tasvir_node *node = d->h->users[i].node;
+        if (node) {
+            size_t node_cap = TASVIR_MSG_MEM_MTU_BYTES(node->mtu ? node->mtu : TASVIR_ETH_MTU);
+            cap = MIN(cap, node_cap);
+        }
+    }
+    return cap;
+}
+
+size_t tasvir_msg_mem_populate(tasvir_msg_mem *m, const tasvir_ext_frame *f) {
+    m->h.dst_tid = ttld.ndata->memcast_tid;
+    m->h.src_tid = ttld.thread->tid;
+    m->h.id = ttld.nr_msgs++ % TASVIR_NR_RPC_MSG;
+    m->h.type = TASVIR_MSG_TYPE_MEM;
+    m->h.d = f->d;
+    m->h.version = f->version;
+    m->addr = f->addr;
+    m->last = f->last;
+    m->seq = f->seq;
+    m->resent = false;
+    m->enc_len = 0;
+
+    /* segments for the payload past the line at the smallest MTU of the users, or a single segment if none are left */
+    struct rte_mbuf *segs[TASVIR_NR_MSG_SEGS_MAX];
+    size_t cap = tasvir_msg_mem_cap(f->d);
+    size_t nr_segs = TASVIR_ALIGNX(cap - TASVIR_MSG_MEM_BYTES, TASVIR_MSG_SEG_BYTES) / TASVIR_MSG_SEG_BYTES;
+    if (nr_segs && rte_pktmbuf_alloc_bulk(ttld.ndata->mp, segs, nr_segs)) {
+        cap = TASVIR_MSG_MEM_BYTES;
+        nr_segs = 0;
+    }
+
+    const uint8_t *src = tasvir_data2pub(f->d, f->addr);
+    m->len = MIN(f->len, cap);
+    if (f->d->opts & TASVIR_AREA_OPT_COMPRESS) {
+        uint8_t *enc = nr_segs ? (uint8_t *)tasvir_msg_mem_buf : (uint8_t *)m->line;
+        size_t enc_len;
+        size_t len = tasvir_zrle_encode(enc, cap, (const uint64_t *)src, f->len, &enc_len);
+        if (len > m->len || (len == m->len && enc_len < len)) {
+            m->len = len;
+            m->enc_len = enc_len;
+            src = enc;
+        }
+    }
+    size_t payload_len = m->enc_len ? m->enc_len : m->len;
+    m->h.mbuf.pkt_len = TASVIR_MSG_MEM_HDR_BYTES + payload_len;
+    ttld.ndata->stats_cur.esync_wire_bytes += payload_len;
+    tasvir_populate_msg_nethdr((tasvir_msg *)m);
+    tasvir_msg_mem_write(m, segs, src, payload_len);
+    size_t nr_used = m->h.mbuf.nb_segs - 1;
+    if (nr_used < nr_segs)
+        rte_mempool_put_bulk(ttld.ndata->mp, (void **)&segs[nr_used], nr_segs - nr_used);
+    return m->len;
+}
+
+/* whether any of the log bits [bit, bit_end) is set */
+static bool tasvir_log_any(const tasvir_log_t *log, size_t bit, size_t bit_end) {
+    for (; bit < bit_end; bit = (bit | (TASVIR_LOG_UNIT_BITS - 1)) + 1) {
+        tasvir_log_t val = log[bit / TASVIR_LOG_UNIT_BITS] << (bit % TASVIR_LOG_UNIT_BITS);
+        if (bit_end - bit < TASVIR_LOG_UNIT_BITS)
+            val &= ~(~(tasvir_log_t)0 >> (bit_end - bit));
+        if (val)
+            return true;
+    }
+    return false;
+}
+
+/* send again the messages a subscriber missed from the published copy. the lines they cover must not have changed
+ * since, which the internal log tells as it only gathers the changes made after the last external sync.
+ */
+void tasvir_handle_msg_nack(tasvir_msg_nack *m) {
+    const tasvir_area_desc *d = m->h.d;
+    if (!d || !d->h || !tasvir_area_is_local(d))
+        goto cleanup;
+    tasvir_area_header *h_rw = tasvir_data2rw(d->h);
+    uint64_t state = 0;
+    bool is_epoch = d->opts & TASVIR_AREA_OPT_EPOCH;
+    if (is_epoch) {
+        if (!tasvir_epoch_trylock(h_rw, &state))
+            goto cleanup;
+        tasvir_area_map_published(d);
+    }
+
+    int shift = tasvir_area_log_shift(d);
+    const tasvir_log_t *log = d->h->diff_log[0].data;
+    size_t nr_frames = MIN(ttld.ndata->nr_ext_frames, TASVIR_NR_EXT_FRAMES);
+    for (size_t i = 1; i <= nr_frames; i++) {
+        const tasvir_ext_frame *f = &ttld.ndata->ext_frames[(ttld.ndata->nr_ext_frames - i) % TASVIR_NR_EXT_FRAMES];
+        if (f->d != d)
+            continue;
+        /* a later version of d went out since, or we are past the messages of this one */
+        if (f->version != m->h.version)
+            break;
+        if (f->seq < m->seq_start || f->seq >= m->seq_end)
+            continue;
+        size_t offset = (uintptr_t)f->addr - (uintptr_t)d->h;
+        bool unchanged = (uintptr_t)f->addr >= (uintptr_t)d->h && offset + f->len <= d->offset_log_end &&
+                         !tasvir_log_any(log, offset >> shift, ((offset + f->len - 1) >> shift) + 1);
+        tasvir_msg_mem *m_mem;
+        if (unchanged && !rte_mempool_get(ttld.ndata->mp, (void **)&m_mem)) {
+            /* it must cover the same memory, which it may not when the mempool is short of segments */
+            bool whole = tasvir_msg_mem_populate(m_mem, f) == f->len;
+            m_mem->resent = true;
+            if (!whole || rte_ring_sp_enqueue(ttld.ndata->ring_ext_tx, m_mem))
+                rte_pktmbuf_free(&m_mem->h.mbuf);
+            else
+                ttld.ndata->stats_cur.esync_resent++;
+        }
+        if (f->seq == m->seq_start)
+            break;
+    }
+
+    if (is_epoch)
+        tasvir_epoch_unlock(h_rw, state);
 cleanup:
     rte_mempool_put(ttld.ndata->mp, (void *)m);
 }
 #endif
 
-/* TODO: could use AVX */
+/* merge the log cachelines of l1 marked in its summary into l2 and clear them; returns the number merged */
+TASVIR_INLINE size_t tasvir_log_rotate_impl(tasvir_area_log *__restrict l1, tasvir_area_log *__restrict l2,
+                                            size_t nr_chunks) {
+    const size_t chunk_units = 1 << (TASVIR_SHIFT_SUMMARY - TASVIR_SHIFT_UNIT);
+    size_t nr_merged = 0;
+    for (size_t c = tasvir_log_summary_next(l1->summary, 0, nr_chunks); c < nr_chunks;
+         c = tasvir_log_summary_next(l1->summary, c + 1, nr_chunks)) {
+        tasvir_log_vec *ptr = (tasvir_log_vec *)&l1->data[c * chunk_units];
+        tasvir_log_vec *ptr_next = (tasvir_log_vec *)&l2->data[c * chunk_units];
+        tasvir_log_vec val = *ptr;
+        if (!tasvir_log_vec_is_zero(&val)) {
+            *ptr_next |= val;
+            *ptr = (tasvir_log_vec){0};
+            tasvir_log_summary_set(l2->summary, c, c);
+            nr_merged++;
+        }
+    }
+    if (nr_chunks)
+        tasvir_log_summary_clear(l1->summary, 0, nr_chunks - 1);
+    return nr_merged;
+}
+
+TASVIR_ISA_DISPATCH(static, size_t, tasvir_log_rotate,
+                    (tasvir_area_log *__restrict l1, tasvir_area_log *__restrict l2, size_t nr_chunks),
+                    (l1, l2, nr_chunks))
+
 static void tasvir_rotate_logs(tasvir_area_desc *__restrict d) {
     /* (assumption: rotate called right after an external sync)
      * rotate the first one on every sync (done inline in tasvir_sync_parse_log)
      * rotate the second one after five seconds
      * rotate the third one after 15 seconds
      */
-    const __m512i zero_v = _mm512_setzero_si512();
+    size_t nr_chunks = d->offset_log_end >> (tasvir_area_log_shift(d) + TASVIR_SHIFT_SUMMARY - TASVIR_SHIFT_BIT);
 
     uint64_t delta_us[TASVIR_NR_AREA_LOGS - 1] = {0, 5 * S2US, 21 * S2US};
     for (int i = TASVIR_NR_AREA_LOGS - 2; i > 0; i--) {
@@ -75,18 +533,7 @@ static void tasvir_rotate_logs(tasvir_area_desc *__restrict d) {
 
         bool cond = l1->version_end > l1->version_start && ttld.ndata->time_us - l1->start_us > delta_us[i];
         if (cond) {
-            __m512i *ptr = (__m512i *)l1->data;
-            __m512i *ptr_next = (__m512i *)l2->data;
-            __m512i *ptr_last = (__m512i *)l2->data;
-            for (; ptr < ptr_last; ptr++, ptr_next++) {
-                __m512i val = _mm512_load_si512(ptr);
-                __mmask16 one_mask = _mm512_test_epi64_mask(val, val);
-                if (one_mask) {
-                    __m512i val_next = _mm512_load_si512(ptr_next);
-                    _mm512_store_epi64((__m512i *)ptr_next, _mm512_or_epi64(val, val_next));
-                    _mm512_store_epi64((__m512i *)ptr, zero_v);
-                }
-            }
+            tasvir_log_rotate(l1, l2, nr_chunks);
 #if 1  // TASVIR_DEBUG_PRINT_LOG_ROTATE
             LOG_DBG("%s rotating %d(v%lu-%lu,t%lu-%lu)->%d(v%lu-%lu,t%lu-%lu)", d->name, i, l1->version_start,
                     l1->version_end, l1->start_us, l1->end_us, i + 1, l2->version_start, l2->version_end, l2->start_us,
@@ -98,16 +545,20 @@ static void tasvir_rotate_logs(tasvir_area_desc *__restrict d) {
     }
 }
 
-size_t tasvir_sync_external_area(tasvir_area_desc *d) {
+static size_t tasvir_sync_external_area_logs(tasvir_area_desc *d) {
     if (!d || !d->owner || !tasvir_area_is_local(d) || d->h->diff_log[0].version_end == 0)
         return 0;
 
+    tasvir_sync_ctl *ctl = d->sync_overhead_pct ? tasvir_sched_ctl(d) : NULL;
+    uint64_t sync_ext_us = ctl ? ctl->ext_us : d->sync_ext_us;
+    if (ctl && (!ttld.ndata->sync_ext_adapt_us || sync_ext_us / 2 < ttld.ndata->sync_ext_adapt_us))
+        ttld.ndata->sync_ext_adapt_us = MAX(sync_ext_us / 2, 1);
     tasvir_area_header *h_ro = tasvir_data2ro(d->h);
-    if (ttld.tdata->time_us - h_ro->last_sync_ext_us_ < d->sync_ext_us || h_ro->flags_ & TASVIR_AREA_FLAG_SLEEPING)
+    if (ttld.tdata->time_us - h_ro->last_sync_ext_us_ < sync_ext_us || h_ro->flags_ & TASVIR_AREA_FLAG_SLEEPING)
         return 0;
 
     h_ro->last_sync_ext_us_ = ttld.tdata->time_us;
-    h_ro->last_sync_ext_bytes_ = 0;
+    h_ro->last_sync_ext_seq_ = 0;
     bool init = ttld.is_root && (d == ttld.root_desc || d == ttld.node_desc) && ttld.ndata->node_init_req;
     int pivot = init ? TASVIR_NR_AREA_LOGS - 1 : 0;
     uint64_t version_min = -1;
@@ -129,7 +580,13 @@ size_t tasvir_sync_external_area(tasvir_area_desc *d) {
             d->h->diff_log[3].version_start, d->h->diff_log[3].version_end);
 #endif
 
+    uint64_t tsc = __rdtsc();
     size_t bytes_changed = tasvir_sync_parse_log(d, 0, d->offset_log_end, pivot);
+    if (ctl) {
+        /* parsing fills the mbufs of the messages; count sending them too */
+        tasvir_service_port_tx();
+        ctl->ext_cost_us += ((__rdtsc() - tsc) * ttld.tsc2usec_mult - ctl->ext_cost_us) / 4;
+    }
     if (bytes_changed) {
         ttld.ndata->stats_cur.esync_changed_bytes += bytes_changed;
         tasvir_rotate_logs(d);
@@ -139,6 +596,21 @@ size_t tasvir_sync_external_area(tasvir_area_desc *d) {
     return bytes_changed;
 }
 
+size_t tasvir_sync_external_area(tasvir_area_desc *d) {
+    if (!d || !d->h || !(d->opts & TASVIR_AREA_OPT_EPOCH))
+        return tasvir_sync_external_area_logs(d);
+
+    /* hold off publication while reading the published copy and updating the logs its writer also updates */
+    tasvir_area_header *h_rw = tasvir_data2rw(d->h);
+    uint64_t state;
+    if (!tasvir_epoch_trylock(h_rw, &state))
+        return 0;
+    tasvir_area_map_published(d);
+    size_t bytes_changed = tasvir_sync_external_area_logs(d);
+    tasvir_epoch_unlock(h_rw, state);
+    return bytes_changed;
+}
+
 /* FIXME: no error handling/reporting */
 int tasvir_sync_external() {
     ttld.ndata->last_sync_ext_start = ttld.ndata->time_us;
@@ -163,6 +635,8 @@ int tasvir_sync_external() {
         }
     }
 
+    /* areas with adaptive intervals shorten the rounds below sync_ext_us while they are walked */
+    ttld.ndata->sync_ext_adapt_us = 0;
     size_t retval = tasvir_area_walk(ttld.root_desc, &tasvir_sync_external_area);
     ttld.ndata->node_init_req = false;
     ttld.ndata->time_us = tasvir_time_us();
@@ -7,6 +7,7 @@ void tasvir_activate(bool active) {
             _mm_pause();
         }
     } else {
+        tasvir_log_flush();
         ttld.tdata->state_req = TASVIR_THREAD_STATE_SLEEPING;
         /* FIXME: without waiting we are risking a potential internal sync failure */
     }
@@ -46,15 +47,146 @@ static void tasvir_kill_thread(tasvir_thread *t /* t is local */) {
     t->state = TASVIR_THREAD_STATE_DEAD;
 }
 
-static size_t tasvir_sched_sync_internal_area(tasvir_area_desc *d) {
-    if (d->sync_int_us < ttld.ndata->sync_int_us) {
-        ttld.ndata->sync_int_us = d->sync_int_us;
-        LOG_INFO("updating internal sync interval to %luus", ttld.ndata->sync_int_us);
+/* whether any log cacheline of d is marked in the log summary */
+static bool tasvir_area_is_dirty(const tasvir_area_desc *d) {
+    size_t base = tasvir_data2summarybit((uintptr_t)d->h);
+    size_t end = base + (d->offset_log_end >> (tasvir_area_log_shift(d) + TASVIR_SHIFT_SUMMARY - TASVIR_SHIFT_BIT));
+    return tasvir_log_summary_next((tasvir_log_t *)TASVIR_ADDR_LOG_SUMMARY, base, end) < end;
+}
+
+/* bytes covered by the log cachelines of d marked in the log summary; an upper bound of its dirty bytes */
+static size_t tasvir_area_dirty_bytes(const tasvir_area_desc *d) {
+    int chunk_shift = tasvir_area_log_shift(d) + TASVIR_SHIFT_SUMMARY - TASVIR_SHIFT_BIT;
+    const tasvir_log_t *summary = (tasvir_log_t *)TASVIR_ADDR_LOG_SUMMARY;
+    size_t base = tasvir_data2summarybit((uintptr_t)d->h);
+    size_t end = base + (d->offset_log_end >> chunk_shift);
+    size_t nr_chunks = 0;
+    for (size_t i = base; i < end; i = (i | (TASVIR_LOG_UNIT_BITS - 1)) + 1) {
+        tasvir_log_t s = summary[i / TASVIR_LOG_UNIT_BITS] << (i % TASVIR_LOG_UNIT_BITS);
+        if (end - i < TASVIR_LOG_UNIT_BITS)
+            s &= ~(~(tasvir_log_t)0 >> (end - i));
+        nr_chunks += __builtin_popcountl(s);
+    }
+    return nr_chunks << chunk_shift;
+}
+
+/* the slot of d in the adaptive interval table or the first free one on its probe run; TASVIR_NR_AREAS if neither */
+static size_t tasvir_sched_ctl_find(const tasvir_area_desc *d) {
+    size_t home = tasvir_area_filter_bit(d);
+    for (size_t n = 0; n < TASVIR_NR_AREAS; n++) {
+        size_t i = (home + n) % TASVIR_NR_AREAS;
+        if (!ttld.ndata->sync_ctl[i].d || ttld.ndata->sync_ctl[i].d == d)
+            return i;
+    }
+    return TASVIR_NR_AREAS;
+}
+
+/* the adaptive interval state of d; areas claim a slot the first time they are looked up. NULL once the table is full
+ * so that d keeps its fixed intervals.
+ */
+tasvir_sync_ctl *tasvir_sched_ctl(const tasvir_area_desc *d) {
+    static bool warned = false;
+    size_t i = tasvir_sched_ctl_find(d);
+    if (i == TASVIR_NR_AREAS) {
+        if (!warned)
+            LOG_ERR("no adaptive interval slot left for d=%s", d->name);
+        warned = true;
+        return NULL;
     }
+    tasvir_sync_ctl *ctl = &ttld.ndata->sync_ctl[i];
+    if (!ctl->d)
+        *ctl = (tasvir_sync_ctl){.d = d, .int_us = d->sync_int_us, .ext_us = d->sync_ext_us};
+    return ctl;
+}
 
+/* free the slot of d and move the later slots of its probe run back so that their lookups still reach them */
+static void tasvir_sched_ctl_free(const tasvir_area_desc *d) {
+    size_t i = tasvir_sched_ctl_find(d);
+    if (i == TASVIR_NR_AREAS || ttld.ndata->sync_ctl[i].d != d)
+        return;
+    for (size_t j = (i + 1) % TASVIR_NR_AREAS; j != i && ttld.ndata->sync_ctl[j].d; j = (j + 1) % TASVIR_NR_AREAS) {
+        size_t home = tasvir_area_filter_bit(ttld.ndata->sync_ctl[j].d);
+        /* slots whose home lies in (i, j] stay put */
+        if ((j - home + TASVIR_NR_AREAS) % TASVIR_NR_AREAS < (j - i + TASVIR_NR_AREAS) % TASVIR_NR_AREAS)
+            continue;
+        ttld.ndata->sync_ctl[i] = ttld.ndata->sync_ctl[j];
+        i = j;
+    }
+    ttld.ndata->sync_ctl[i] = (tasvir_sync_ctl){0};
+}
+
+/* pick the shortest intervals for d that keep the time spent in its syncs under d->sync_overhead_pct.
+ * a round costs its threads the barrier plus copying the bytes changed since the previous one, so at interval i the
+ * share of time spent syncing is fixed / i + rate * per_byte. external syncs cost the daemon about the same each time.
+ */
+static void tasvir_sched_adapt(tasvir_sync_ctl *ctl) {
+    const tasvir_area_desc *d = ctl->d;
+    double share = d->sync_overhead_pct / 100. - ctl->rate * ttld.ndata->sync_us_per_byte;
+    double int_us = share > 0 ? ttld.ndata->sync_fixed_us / share : d->sync_int_us;
+    ctl->int_us = MIN(MAX(int_us, TASVIR_SYNC_ADAPT_MIN_US), d->sync_int_us);
+    /* changes reach remote nodes no sooner than the local ones */
+    double ext_us = MAX(ctl->ext_cost_us * 100 / d->sync_overhead_pct, ctl->int_us);
+    ctl->ext_us = MIN(MAX(ext_us, TASVIR_SYNC_ADAPT_MIN_US), d->sync_ext_us);
+}
+
+/* learn from the last round: the barrier and copy costs of the node and the change rates of the adaptive areas */
+static void tasvir_sched_feedback(uint64_t barrier_us, uint64_t copy_us) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < ttld.ndata->nr_jobs; i++)
+        bytes += ttld.ndata->jobs[i].bytes_updated;
+    ttld.ndata->sync_fixed_us += (barrier_us - ttld.ndata->sync_fixed_us) / 4;
+    if (bytes)
+        ttld.ndata->sync_us_per_byte += ((double)copy_us / bytes - ttld.ndata->sync_us_per_byte) / 4;
+
+    for (size_t i = 0; i < ttld.ndata->nr_jobs; i++) {
+        const tasvir_sync_job *j = &ttld.ndata->jobs[i];
+        tasvir_sync_ctl *ctl = j->d->sync_overhead_pct ? tasvir_sched_ctl(j->d) : NULL;
+        if (!ctl)
+            continue;
+        if (ctl->last_int_us && ttld.ndata->time_us > ctl->last_int_us)
+            ctl->rate += ((double)j->bytes_updated / (ttld.ndata->time_us - ctl->last_int_us) - ctl->rate) / 4;
+        ctl->last_int_us = ttld.ndata->time_us;
+        tasvir_sched_adapt(ctl);
+    }
+}
+
+/* add d to the heap of internal sync deadlines */
+static void tasvir_sched_push(tasvir_area_desc *d, uint64_t due_us) {
+    tasvir_sync_deadline *heap = ttld.ndata->sync_deadlines;
+    size_t i = ttld.ndata->nr_sync_deadlines++;
+    for (; i > 0 && heap[(i - 1) / 2].due_us > due_us; i = (i - 1) / 2)
+        heap[i] = heap[(i - 1) / 2];
+    heap[i] = (tasvir_sync_deadline){.due_us = due_us, .d = d};
+}
+
+/* remove the earliest deadline from the heap */
+static tasvir_sync_deadline tasvir_sched_pop() {
+    tasvir_sync_deadline *heap = ttld.ndata->sync_deadlines;
+    tasvir_sync_deadline top = heap[0];
+    tasvir_sync_deadline last = heap[--ttld.ndata->nr_sync_deadlines];
+    size_t n = ttld.ndata->nr_sync_deadlines;
+    size_t i = 0;
+    for (size_t c; (c = 2 * i + 1) < n; i = c) {
+        if (c + 1 < n && heap[c + 1].due_us < heap[c].due_us)
+            c++;
+        if (last.due_us <= heap[c].due_us)
+            break;
+        heap[i] = heap[c];
+    }
+    heap[i] = last;
+    return top;
+}
+
+static void tasvir_sched_sync_job(tasvir_area_desc *d) {
+    if (!tasvir_area_is_active_local(d))
+        return;
     tasvir_area_header *h_rw = tasvir_data2rw(d->h);
     if (h_rw->flags_ & (TASVIR_AREA_FLAG_EXT_PENDING | TASVIR_AREA_FLAG_SLEEPING))
-        return 0;
+        return;
+
+    /* auto-tracked areas only find their changes during the sync */
+    if (!(d->opts & TASVIR_AREA_OPT_TRACK_AUTO) && !tasvir_area_is_dirty(d))
+        return;
 
     if (ttld.ndata->nr_jobs >= TASVIR_NR_SYNC_JOBS) {
         LOG_ERR("more sync jobs than free slots. aborting...");
@@ -62,20 +194,286 @@ static size_t tasvir_sched_sync_internal_area(tasvir_area_desc *d) {
     }
     tasvir_sync_job *j = &ttld.ndata->jobs[ttld.ndata->nr_jobs];
     j->d = d;
-    /* FIXME: adjust thresholds per uarch
-     * self sync for small areas (<500KB)
-     */
-    j->self_sync = d->offset_log_end < 500 * KB;
-    j->done_stage1 = false;
-    j->done_stage2 = false;
-    j->done_stage3 = false;
-    j->offset = 0;
+    /* auto-tracked areas wait for their owner to log dirty pages first */
+    j->done_stage0 = !(d->opts & TASVIR_AREA_OPT_TRACK_AUTO) || !tasvir_area_is_local(d) ||
+                     ttld.ndata->tdata[d->owner->tid.idx].state != TASVIR_THREAD_STATE_RUNNING;
+    j->nr_tasks_left = 0;
     j->bytes_seen = 0;
     j->bytes_updated = 0;
+    j->bytes_suppressed = 0;
 
     ttld.ndata->job_bytes += d->offset_log_end;
     ttld.ndata->nr_jobs++;
-    return ttld.ndata->job_bytes;
+}
+
+/* schedule areas seen for the first time right away */
+static void tasvir_sched_sync_internal_area(tasvir_area_desc *d) {
+    /* epoch areas are published by their writers without a barrier */
+    if (d->opts & TASVIR_AREA_OPT_EPOCH)
+        return;
+
+    tasvir_area_header *h_rw = tasvir_data2rw(d->h);
+    if (!(h_rw->flags_ & TASVIR_AREA_FLAG_SCHEDULED)) {
+        if (ttld.ndata->nr_sync_deadlines >= TASVIR_NR_AREAS) {
+            LOG_ERR("more areas than internal sync deadlines. aborting...");
+            abort();
+        }
+        h_rw->flags_ |= TASVIR_AREA_FLAG_SCHEDULED;
+        tasvir_sched_push(d, ttld.ndata->time_us);
+        ttld.ndata->nr_sync_dirty += d->sync_dirty_bytes > 0;
+    }
+}
+
+/* schedule the areas under container c that became active since the last round. the areas of a container are
+ * looked at again only when it gains some or some of them were not active yet, so a round visits the containers
+ * rather than every area.
+ */
+static void tasvir_sched_scan_container(tasvir_area_desc *c) {
+    if (!tasvir_area_is_active_local(c))
+        return;
+    tasvir_sched_sync_internal_area(c);
+    tasvir_sched_scan *s = &ttld.ndata->sched_scans[tasvir_area_filter_bit(c)];
+    size_t nr_areas = c->h->nr_areas;
+    bool scanned = s->c == c && s->nr_areas == nr_areas;
+    if (scanned && !s->has_containers)
+        return;
+
+    tasvir_area_desc *children = tasvir_data(c);
+    bool done = true;
+    bool has_containers = false;
+    for (size_t i = 0; i < nr_areas; i++) {
+        tasvir_area_desc *d = &children[i];
+        if (d->type == TASVIR_AREA_TYPE_CONTAINER) {
+            has_containers = true;
+            tasvir_sched_scan_container(d);
+        } else if (!scanned) {
+            if (tasvir_area_is_active_local(d))
+                tasvir_sched_sync_internal_area(d);
+            else
+                done = false;
+        }
+    }
+    if (!scanned)
+        *s = (tasvir_sched_scan){.c = done ? c : NULL, .nr_areas = nr_areas, .has_containers = has_containers};
+}
+
+/* threads that must be quiescent during job j besides the daemon and the helpers: the writer and every thread that
+ * attached the area. everyone reads containers and node areas so they involve all threads.
+ */
+static uint64_t tasvir_sched_job_threads(const tasvir_sync_job *j) {
+    const tasvir_area_desc *d = j->d;
+    if (d->type != TASVIR_AREA_TYPE_APP)
+        return ~0UL;
+    uint64_t threads = 0;
+    if (tasvir_area_is_local(d))
+        threads |= 1UL << d->owner->tid.idx;
+    size_t bit = tasvir_area_filter_bit(d);
+    for (size_t tid = 0; tid < TASVIR_NR_THREADS_LOCAL; tid++)
+        threads |= (ttld.ndata->tdata[tid].areas_filter[bit / 64] >> (bit % 64) & 1) << tid;
+    return threads;
+}
+
+/* threads that can take part in a sync, and the daemon and helpers that belong to no sync domain of their own */
+static void tasvir_sched_threads(uint64_t *running, uint64_t *shared) {
+    *running = 0;
+    *shared = 1UL << TASVIR_THREAD_DAEMON_IDX;
+    for (size_t tid = 0; tid < TASVIR_NR_THREADS_LOCAL; tid++) {
+        const tasvir_local_tdata *tdata = &ttld.ndata->tdata[tid];
+        *running |= (uint64_t)(tdata->state == TASVIR_THREAD_STATE_RUNNING && !atomic_load(&tdata->parked)) << tid;
+        *shared |= (uint64_t)tdata->is_helper << tid;
+    }
+}
+
+/* threads that must be quiescent during the jobs of this round: the daemon and the users of their areas. the jobs
+ * never include epoch areas, the only work helpers take over, so helpers that use none of the areas stay out of the
+ * barrier instead of adding to its wait.
+ */
+static uint64_t tasvir_sched_sync_threads() {
+    uint64_t running, threads;
+    tasvir_sched_threads(&running, &threads);
+    threads &= 1UL << TASVIR_THREAD_DAEMON_IDX;
+    for (size_t i = 0; i < ttld.ndata->nr_jobs; i++)
+        threads |= tasvir_sched_job_threads(&ttld.ndata->jobs[i]);
+    return threads & running;
+}
+
+/* keep the jobs of one sync domain for this round and defer the others to the next one. jobs whose areas are used by
+ * a common thread are in the same domain, so threads of unrelated areas never wait at each other's barrier.
+ */
+static void tasvir_sched_sync_domain() {
+    static uint64_t job_threads[TASVIR_NR_SYNC_JOBS];
+    uint64_t running, shared;
+    tasvir_sched_threads(&running, &shared);
+    for (size_t i = 0; i < ttld.ndata->nr_jobs; i++)
+        job_threads[i] = tasvir_sched_job_threads(&ttld.ndata->jobs[i]) & running & ~shared;
+
+    /* grow the domain of the first job until no other job shares a thread with it; jobs that involve no thread of
+     * their own form a domain of their own
+     */
+    uint64_t domain = job_threads[0];
+    for (uint64_t prev = ~domain; domain && domain != prev;) {
+        prev = domain;
+        for (size_t i = 1; i < ttld.ndata->nr_jobs; i++)
+            if (job_threads[i] & domain)
+                domain |= job_threads[i];
+    }
+
+    size_t nr_jobs = 0;
+    ttld.ndata->job_bytes = 0;
+    for (size_t i = 0; i < ttld.ndata->nr_jobs; i++) {
+        tasvir_sync_job *j = &ttld.ndata->jobs[i];
+        if (domain ? job_threads[i] & domain : !job_threads[i]) {
+            ttld.ndata->job_bytes += j->d->offset_log_end;
+            ttld.ndata->jobs[nr_jobs++] = *j;
+        } else {
+            ttld.ndata->sync_deferred[ttld.ndata->nr_sync_deferred++] = j->d;
+        }
+    }
+    ttld.ndata->nr_jobs = nr_jobs;
+}
+
+/* bytes of the tasks of job j; tasks must cover whole log cachelines of areas with a coarse granularity */
+static size_t tasvir_sync_task_bytes(const tasvir_sync_job *j) {
+    return TASVIR_ALIGNX(ttld.ndata->job_bytes,
+                         1UL << (tasvir_area_log_shift(j->d) + TASVIR_SHIFT_SUMMARY - TASVIR_SHIFT_BIT));
+}
+
+/* the thread that writes the area of job j and whose socket its pages most likely live on */
+static size_t tasvir_sync_job_writer(const tasvir_sync_job *j) {
+    const tasvir_area_desc *d = j->d;
+    if (tasvir_area_is_local(d) && ttld.ndata->tdata[d->owner->tid.idx].state == TASVIR_THREAD_STATE_RUNNING)
+        return d->owner->tid.idx;
+    return TASVIR_THREAD_DAEMON_IDX;
+}
+
+/* whether thread tid takes sync tasks; every thread of the sync does */
+static bool tasvir_sync_task_thread(size_t tid) { return ttld.ndata->sync_threads >> tid & 1; }
+
+/* split jobs into tasks and seed the task deques of running threads.
+ * small areas go to their writer whose cache likely holds them; the rest go to the least loaded thread on the socket
+ * of the writer, or anywhere if that socket has no running thread.
+ */
+static void tasvir_sched_sync_tasks() {
+    size_t nr_tasks;
+    for (;; ttld.ndata->job_bytes *= 2) {
+        nr_tasks = 0;
+        for (size_t i = 0; i < ttld.ndata->nr_jobs; i++) {
+            size_t task_bytes = tasvir_sync_task_bytes(&ttld.ndata->jobs[i]);
+            nr_tasks += (ttld.ndata->jobs[i].d->offset_log_end + task_bytes - 1) / task_bytes;
+        }
+        if (nr_tasks <= TASVIR_NR_SYNC_TASKS)
+            break;
+    }
+
+    static tasvir_sync_task tasks[TASVIR_NR_SYNC_TASKS];
+    static uint8_t task_tid[TASVIR_NR_SYNC_TASKS];
+    size_t load[TASVIR_NR_THREADS_LOCAL] = {0};
+    size_t nr_thread_tasks[TASVIR_NR_THREADS_LOCAL] = {0};
+    size_t t = 0;
+    for (size_t i = 0; i < ttld.ndata->nr_jobs; i++) {
+        tasvir_sync_job *j = &ttld.ndata->jobs[i];
+        size_t task_bytes = tasvir_sync_task_bytes(j);
+        size_t writer = tasvir_sync_job_writer(j);
+        int socket = ttld.ndata->tdata[writer].socket;
+        bool self_sync = j->d->offset_log_end < ttld.ndata->self_sync_bytes && tasvir_sync_task_thread(writer);
+        for (size_t offset = 0; offset < j->d->offset_log_end; offset += task_bytes, t++) {
+            size_t tid_min = writer;
+            if (!self_sync) {
+                size_t load_min = SIZE_MAX;
+                for (size_t tid = 0; tid < TASVIR_NR_THREADS_LOCAL; tid++) {
+                    tasvir_local_tdata *tdata = &ttld.ndata->tdata[tid];
+                    if (!tasvir_sync_task_thread(tid))
+                        continue;
+                    /* a thread on another socket must be less loaded by a whole task to be picked */
+                    size_t l = load[tid] + (tdata->socket == socket ? 0 : task_bytes);
+                    if (l < load_min) {
+                        load_min = l;
+                        tid_min = tid;
+                    }
+                }
+            }
+            size_t len = MIN(task_bytes, j->d->offset_log_end - offset);
+            tasks[t] = (tasvir_sync_task){.offset = offset, .len = len, .job = i};
+            task_tid[t] = tid_min;
+            load[tid_min] += len;
+            nr_thread_tasks[tid_min]++;
+        }
+        j->nr_tasks_left = (j->d->offset_log_end + task_bytes - 1) / task_bytes;
+    }
+
+    /* lay the tasks of each thread out contiguously and in job order */
+    size_t head[TASVIR_NR_THREADS_LOCAL];
+    size_t pos[TASVIR_NR_THREADS_LOCAL];
+    for (size_t tid = 0, sum = 0; tid < TASVIR_NR_THREADS_LOCAL; sum += nr_thread_tasks[tid++])
+        head[tid] = pos[tid] = sum;
+    for (t = 0; t < nr_tasks; t++)
+        ttld.ndata->tasks[pos[task_tid[t]]++] = tasks[t];
+    for (size_t tid = 0; tid < TASVIR_NR_THREADS_LOCAL; tid++)
+        ttld.ndata->tdata[tid].sync_tasks = (uint64_t)head[tid] << 32 | pos[tid];
+    ttld.ndata->nr_tasks = nr_tasks;
+    ttld.ndata->nr_tasks_left = nr_tasks;
+}
+
+/* whether item j joins the node of item i at level; items are sorted by socket and last level cache */
+static bool tasvir_barrier_same_node(const tasvir_local_tdata *i, const tasvir_local_tdata *j, int level,
+                                     size_t nr_children) {
+    switch (level) {
+    case 0: /* core pairs */
+        return nr_children < 2 && i->socket == j->socket && i->llc == j->llc;
+    case 1: /* last level caches */
+        return i->socket == j->socket && i->llc == j->llc;
+    case 2: /* sockets */
+        return i->socket == j->socket;
+    default:
+        return true;
+    }
+}
+
+/* build the combining tree of the barrier over the threads of this sync; contended counters stay within a cache */
+static void tasvir_barrier_build() {
+    /* representative thread of each item at the current level, sorted by socket, last level cache and cpu */
+    const tasvir_local_tdata *rep[TASVIR_NR_THREADS_LOCAL];
+    size_t item[TASVIR_NR_THREADS_LOCAL];
+    size_t nr_items = 0;
+    for (size_t tid = 0; tid < TASVIR_NR_THREADS_LOCAL; tid++) {
+        const tasvir_local_tdata *tdata = &ttld.ndata->tdata[tid];
+        if (!(ttld.ndata->sync_threads >> tid & 1))
+            continue;
+        size_t i = nr_items++;
+        for (; i > 0; i--) {
+            const tasvir_local_tdata *prev = rep[i - 1];
+            if (prev->socket < tdata->socket || (prev->socket == tdata->socket && prev->llc < tdata->llc) ||
+                (prev->socket == tdata->socket && prev->llc == tdata->llc && prev->cpu <= tdata->cpu))
+                break;
+            rep[i] = rep[i - 1];
+            item[i] = item[i - 1];
+        }
+        rep[i] = tdata;
+        item[i] = tid;
+    }
+
+    size_t nr_nodes = 0;
+    for (int level = 0; level < TASVIR_BARRIER_LEVELS; level++) {
+        size_t nr_next = 0;
+        tasvir_barrier_node *node = NULL;
+        for (size_t i = 0; i < nr_items; i++) {
+            size_t child = item[i];
+            if (!node || !tasvir_barrier_same_node(rep[nr_next - 1], rep[i], level, node->nr_left)) {
+                node = &ttld.ndata->barrier_nodes[nr_nodes];
+                node->nr_left = 0;
+                node->level = level;
+                rep[nr_next] = rep[i];
+                item[nr_next++] = nr_nodes++;
+            }
+            node->nr_left++;
+            if (level == 0)
+                ttld.ndata->tdata[child].barrier_node = node - ttld.ndata->barrier_nodes;
+            else
+                ttld.ndata->barrier_nodes[child].parent = node - ttld.ndata->barrier_nodes;
+        }
+        nr_items = nr_next;
+    }
+    ttld.ndata->nr_barrier_nodes = nr_nodes;
 }
 
 void tasvir_sched_sync_internal() {
@@ -83,6 +481,7 @@ void tasvir_sched_sync_internal() {
     if (pending)
         return;
     size_t nr_threads = 0;
+    size_t nr_helpers = 0;
     /* heartbeat: declare unresponsive threads dead */
     for (size_t tid = 0; tid < TASVIR_NR_THREADS_LOCAL; tid++) {
         if (ttld.ndata->tdata[tid].state_req != TASVIR_THREAD_STATE_INVALID &&
@@ -103,6 +502,7 @@ void tasvir_sched_sync_internal() {
                     ttld.node->threads[tid].time_us = ttld.ndata->tdata[tid].time_us;
                 }
                 nr_threads++;
+                nr_helpers += ttld.ndata->tdata[tid].is_helper;
             }
         }
     }
@@ -110,9 +510,9 @@ void tasvir_sched_sync_internal() {
     bool changed = false;
     for (size_t i = 0; i < ttld.node->nr_areas; i++) {
         tasvir_area_desc *d = ttld.node->areas_d[i];
-        tasvir_area_header *h_ro = tasvir_data2ro(d->h);
+        tasvir_area_header *h_pub = tasvir_data2pub(d, d->h);
         // FIXME: not quite right due to incomplete/pending updates
-        uint64_t v = h_ro->version;
+        uint64_t v = h_pub->version;
         if (ttld.node->areas_v[i] != v) {
             tasvir_log(&ttld.node->areas_v[i], sizeof(ttld.node->areas_v[i]));
             changed = true;
@@ -125,123 +525,432 @@ void tasvir_sched_sync_internal() {
 #endif
     }
 
+    if (ttld.ndata->nr_helpers != nr_helpers) {
+        ttld.ndata->nr_helpers = nr_helpers;
+        LOG_INFO("%lu sync helpers running", nr_helpers);
+    }
+
     ttld.ndata->nr_jobs = 0;
     ttld.ndata->job_bytes = 0;
-    tasvir_area_walk(ttld.root_desc, &tasvir_sched_sync_internal_area);
-    ttld.ndata->job_bytes /= nr_threads * 8;
+    bool sync_req = ttld.ndata->sync_req;
+    if (ttld.ndata->nr_sync_deferred) {
+        /* the domains left over from the previous round go first; due areas and requests wait for the round after */
+        size_t nr_deferred = ttld.ndata->nr_sync_deferred;
+        ttld.ndata->nr_sync_deferred = 0;
+        for (size_t i = 0; i < nr_deferred; i++)
+            tasvir_sched_sync_job(ttld.ndata->sync_deferred[i]);
+    } else {
+        ttld.ndata->sync_req_round = sync_req;
+        tasvir_sched_scan_container(ttld.root_desc);
+        /* a requested sync covers every scheduled area including the deferred ones */
+        for (size_t i = 0; i < ttld.ndata->nr_sync_deadlines && sync_req; i++)
+            tasvir_sched_sync_job(ttld.ndata->sync_deadlines[i].d);
+        /* every area follows its own interval; a requested sync already covered the due ones */
+        while (ttld.ndata->nr_sync_deadlines && ttld.ndata->sync_deadlines[0].due_us <= ttld.ndata->time_us) {
+            tasvir_sync_deadline dl = tasvir_sched_pop();
+            /* areas that went away leave the schedule along with their adaptive state */
+            if (!tasvir_area_is_active_local(dl.d)) {
+                ttld.ndata->nr_sync_dirty -= dl.d->sync_dirty_bytes > 0;
+                if (dl.d->h)
+                    ((tasvir_area_header *)tasvir_data2rw(dl.d->h))->flags_ &= ~TASVIR_AREA_FLAG_SCHEDULED;
+                tasvir_sched_ctl_free(dl.d);
+                continue;
+            }
+            if (!sync_req)
+                tasvir_sched_sync_job(dl.d);
+            tasvir_sync_ctl *ctl = dl.d->sync_overhead_pct ? tasvir_sched_ctl(dl.d) : NULL;
+            uint64_t int_us = ctl ? ctl->int_us : dl.d->sync_int_us;
+            dl.due_us += int_us;
+            /* skip the rounds missed while the daemon was busy instead of bunching them up */
+            if (dl.due_us <= ttld.ndata->time_us)
+                dl.due_us = ttld.ndata->time_us + int_us;
+            tasvir_sched_push(dl.d, dl.due_us);
+        }
+        /* areas that dirtied more than their threshold do not wait for their deadline */
+        for (size_t i = 0; i < ttld.ndata->nr_sync_deadlines && ttld.ndata->nr_sync_dirty && !sync_req; i++) {
+            tasvir_area_desc *d = ttld.ndata->sync_deadlines[i].d;
+            if (!d->sync_dirty_bytes || tasvir_area_dirty_bytes(d) < d->sync_dirty_bytes)
+                continue;
+            size_t j = 0;
+            while (j < ttld.ndata->nr_jobs && ttld.ndata->jobs[j].d != d)
+                j++;
+            if (j == ttld.ndata->nr_jobs)
+                tasvir_sched_sync_job(d);
+        }
+    }
+    ttld.ndata->sync_int_due_us = ttld.ndata->time_us + TASVIR_SYNC_INTERNAL_US;
+    if (ttld.ndata->nr_sync_deadlines)
+        ttld.ndata->sync_int_due_us = MIN(ttld.ndata->sync_int_due_us, ttld.ndata->sync_deadlines[0].due_us);
+    if (ttld.ndata->nr_sync_dirty)
+        ttld.ndata->sync_int_due_us =
+            MIN(ttld.ndata->sync_int_due_us, ttld.ndata->time_us + TASVIR_SYNC_DIRTY_CHECK_US);
+    if (!ttld.ndata->nr_jobs) {
+        /* no area needs the barrier this round */
+        if (ttld.ndata->sync_req_round)
+            ttld.ndata->sync_req = false;
+        ttld.ndata->last_sync_int_end = ttld.ndata->time_us;
+        return;
+    }
+    tasvir_sched_sync_domain();
+    if (ttld.ndata->nr_sync_deferred)
+        ttld.ndata->sync_int_due_us = ttld.ndata->time_us;
+    /* pins that are not visible to tasvir_sched_sync_threads wait for this round to end */
+    atomic_fetch_add(&ttld.ndata->sync_int_round, 1);
+    ttld.ndata->sync_threads = tasvir_sched_sync_threads();
+    nr_threads = __builtin_popcountl(ttld.ndata->sync_threads);
+    ttld.ndata->job_bytes /= nr_threads * ttld.ndata->tasks_per_thread;
     ttld.ndata->job_bytes &= ~(TASVIR_ALIGNMENT - 1);
-    ttld.ndata->job_bytes = MAX(ttld.ndata->job_bytes, TASVIR_ALIGNMENT * 4);
+    ttld.ndata->job_bytes = MAX(ttld.ndata->job_bytes, ttld.ndata->task_bytes_min);
+    tasvir_sched_sync_tasks();
 
     /* using tsc as sync sequence number since it has a healthy gap from the previous one */
     ttld.ndata->barrier_end_tsc = __rdtsc() + tasvir_usec2tsc(TASVIR_BARRIER_ENTER_US);
-    ttld.ndata->barrier_cnt = nr_threads;
+    tasvir_barrier_build();
     size_t next_sync_seq = ttld.ndata->barrier_end_tsc;
     ttld.ndata->barrier_seq = next_sync_seq;
     for (size_t tid = 0; tid < TASVIR_NR_THREADS_LOCAL; tid++) {
-        if (ttld.ndata->tdata[tid].state == TASVIR_THREAD_STATE_RUNNING) {
+        if (ttld.ndata->sync_threads >> tid & 1) {
             ttld.ndata->tdata[tid].next_sync_seq = next_sync_seq;
         }
     }
+    /* threads that parked after being picked see the new sequence or get woken up for it */
+    atomic_thread_fence(memory_order_seq_cst);
+    for (size_t tid = 0; tid < TASVIR_NR_THREADS_LOCAL; tid++)
+        if (ttld.ndata->sync_threads >> tid & 1 && atomic_load(&ttld.ndata->tdata[tid].parked))
+            tasvir_wake(&ttld.ndata->tdata[tid]);
 }
 #endif
 
-/* returns true if the job is done */
-static bool tasvir_sync_internal_job(tasvir_sync_job *j) {
+/* update the local header fields of a copy of d that just received its changes */
+static void tasvir_sync_publish_header(const tasvir_area_desc *__restrict d, tasvir_area_header *__restrict h_rw,
+                                       tasvir_area_header *__restrict h_pub) {
+    h_pub->flags_ = h_rw->flags_ & (TASVIR_AREA_FLAG_ACTIVE | TASVIR_AREA_FLAG_LOCAL);
+    if (tasvir_area_is_local(d)) {
+        h_pub->time_us = h_pub->diff_log[0].end_us = h_rw->time_us = h_rw->diff_log[0].end_us = ttld.ndata->time_us;
+        h_pub->version = h_pub->diff_log[0].version_end = h_rw->diff_log[0].version_end = h_rw->version;
+        ++h_rw->version;
+        /* mark second cacheline modified: the run of bits [bit, bit_end) of the granules that cover it */
+        int shift = tasvir_area_log_shift(d);
+        size_t bit = TASVIR_CACHELINE_BYTES >> shift;
+        size_t bit_end = MAX((2 * TASVIR_CACHELINE_BYTES) >> shift, 1);
+        *h_rw->diff_log[0].data |= (~0UL >> bit) & ~(~0UL >> bit_end);
+        *h_rw->diff_log[0].summary |= 1UL << 63;
+#ifdef TASVIR_DEBUG_PRINT_VIEWS
+        LOG_DBG("d=%s v_rw=%lu v_pub=%lu", d->name, h_rw->version, h_pub->version);
+#endif
+    }
+
+    /* the rest of the header reaches the replicas with the changed lines */
+    for (int socket = 1; socket < TASVIR_NR_SOCKETS && d->opts & TASVIR_AREA_OPT_REPLICATE; socket++) {
+        tasvir_area_header *__restrict h_rep = tasvir_data2replica(d->h, socket);
+        h_rep->flags_ = h_pub->flags_;
+        h_rep->time_us = h_pub->time_us;
+        h_rep->version = h_pub->version;
+        h_rep->diff_log[0].end_us = h_pub->diff_log[0].end_us;
+        h_rep->diff_log[0].version_end = h_pub->diff_log[0].version_end;
+    }
+}
+
+/* take a task from the head of the deque of tdata, or from its tail when stealing */
+static tasvir_sync_task *tasvir_sync_task_take(tasvir_local_tdata *tdata, bool steal) {
+    uint_fast64_t q = atomic_load_explicit(&tdata->sync_tasks, memory_order_relaxed);
+    while ((q >> 32) < (uint32_t)q) {
+        uint_fast64_t q_new = steal ? q - 1 : q + (1UL << 32);
+        if (atomic_compare_exchange_weak(&tdata->sync_tasks, &q, q_new))
+            return &ttld.ndata->tasks[steal ? (uint32_t)q - 1 : q >> 32];
+    }
+    return NULL;
+}
+
+/* steal from threads on the same socket first */
+static tasvir_sync_task *tasvir_sync_task_steal() {
+    size_t self = ttld.tdata - ttld.ndata->tdata;
+    for (int remote = 0; remote < 2; remote++) {
+        for (size_t i = 1; i < TASVIR_NR_THREADS_LOCAL; i++) {
+            tasvir_local_tdata *tdata = &ttld.ndata->tdata[(self + i) % TASVIR_NR_THREADS_LOCAL];
+            if ((tdata->socket != ttld.tdata->socket) != remote)
+                continue;
+            tasvir_sync_task *t = tasvir_sync_task_take(tdata, true);
+            if (t)
+                return t;
+        }
+    }
+    return NULL;
+}
+
+static void tasvir_sync_internal_task(const tasvir_sync_task *t) {
+    tasvir_sync_job *__restrict j = &ttld.ndata->jobs[t->job];
+    const tasvir_area_desc *__restrict d = j->d;
+    while (!__atomic_load_n(&j->done_stage0, __ATOMIC_ACQUIRE))
+        _mm_pause();
+
+    ttld.tdata->sync_list.to_replicas = d->opts & TASVIR_AREA_OPT_REPLICATE;
+    ttld.tdata->sync_list.snapshots = tasvir_snapshot_slots(d);
+    tasvir_sync_parse_log(d, t->offset, t->len, 0);
+    size_t updated = tasvir_sync_process_changes(NULL, true, false);
+    ttld.tdata->sync_list.snapshots = 0;
+    ttld.tdata->sync_list.to_replicas = false;
+    if (updated)
+        atomic_fetch_add_explicit(&j->bytes_updated, updated, memory_order_relaxed);
+    if (ttld.tdata->sync_list.suppressed) {
+        atomic_fetch_add_explicit(&j->bytes_suppressed, ttld.tdata->sync_list.suppressed, memory_order_relaxed);
+        ttld.tdata->sync_list.suppressed = 0;
+    }
+    atomic_fetch_add_explicit(&j->bytes_seen, t->len, memory_order_relaxed);
+
+    /* the last task of the job publishes the header once all copies are done */
+    if (atomic_fetch_sub(&j->nr_tasks_left, 1) == 1) {
+        tasvir_area_header *__restrict h_rw = tasvir_data2rw(d->h);
+        if (h_rw->flags_ & TASVIR_AREA_FLAG_EXT_ENQUEUE)
+            h_rw->flags_ &= ~TASVIR_AREA_FLAG_EXT_ENQUEUE;
+        if (atomic_load_explicit(&j->bytes_updated, memory_order_relaxed)) {
+            tasvir_sync_publish_header(d, h_rw, tasvir_data2ro(d->h));
+            tasvir_wake_waiters(d);
+        }
+    }
+    atomic_fetch_sub(&ttld.ndata->nr_tasks_left, 1);
+}
+
+static void tasvir_sync_internal_job_postprocess(const tasvir_sync_job *j) {
     const tasvir_area_desc *__restrict d = j->d;
-    bool is_local = tasvir_area_is_local(d);
     bool is_local_writer = d->owner == ttld.thread;
 #ifdef TASVIR_DAEMON
     if (!is_local_writer)
-        is_local_writer = !is_local;
+        is_local_writer = !tasvir_area_is_local(d);
 #endif
+    if (!is_local_writer || !atomic_load_explicit(&j->bytes_updated, memory_order_relaxed))
+        return;
 
-    if (j->done_stage2)
-        return true;
+    /* FIXME: here I should really only reclaim modified lines but tracking them is a bit hard */
+    size_t log_units = d->offset_log_end >> (tasvir_area_log_shift(d) + TASVIR_SHIFT_UNIT - TASVIR_SHIFT_BIT);
+    size_t log_bytes = log_units * sizeof(tasvir_log_t);
+    if (log_bytes < ttld.ndata->log_prefetch_bytes) {
+        const size_t jump = TASVIR_CACHELINE_BYTES / sizeof(tasvir_log_t);
+        tasvir_log_t *log = tasvir_data2log(d->h);
+        for (size_t i = 0; i < log_units; i += jump)
+            _mm_prefetch(log + i, _MM_HINT_T1);
+    }
+}
 
-    if (j->self_sync && !is_local_writer)  // non-cooperative sync
-        return false;
+/* log slot i after the diff logs of an epoch area in the RW copy where writers and helpers both reach it:
+ * slot 0 holds the lines that the copy not currently published missed while it was published last,
+ * slot 1 the lines handed off to be copied into it
+ */
+static tasvir_area_log tasvir_epoch_log(const tasvir_area_header *h, int i) {
+    /* allocated right after the diff logs and laid out the same way */
+    const tasvir_area_log *l = &h->diff_log[TASVIR_NR_AREA_LOGS - 1];
+    const tasvir_area_log *l_prev = &h->diff_log[TASVIR_NR_AREA_LOGS - 2];
+    return (tasvir_area_log){.data = tasvir_data2rw(l->data + (i + 1) * (l->data - l_prev->data)),
+                             .summary = tasvir_data2rw(l->summary + (i + 1) * (l->summary - l_prev->summary))};
+}
 
-    if (j->done_stage1)
-        return false;
+/* move the logged lines into next and keep in prev what the other copy will miss once this one is published.
+ * a fresh hand-off also moves the lines prev held, a retry only adds the newly logged lines to prev.
+ */
+TASVIR_INLINE size_t tasvir_epoch_handoff_log_impl(tasvir_log_t *__restrict log, tasvir_log_t *__restrict summary,
+                                                   size_t summary_base, tasvir_area_log *__restrict prev,
+                                                   tasvir_area_log *__restrict next, size_t nr_chunks, bool retry) {
+    const size_t chunk_units = 1 << (TASVIR_SHIFT_SUMMARY - TASVIR_SHIFT_UNIT);
+    size_t nr_merged = 0;
+    for (size_t c = 0; c < nr_chunks; c++) {
+        size_t c_log = tasvir_log_summary_next(summary, summary_base + c, summary_base + nr_chunks) - summary_base;
+        c = retry ? c_log : MIN(c_log, tasvir_log_summary_next(prev->summary, c, nr_chunks));
+        if (c >= nr_chunks)
+            break;
+        tasvir_log_vec *ptr = (tasvir_log_vec *)&log[c * chunk_units];
+        tasvir_log_vec *ptr_prev = (tasvir_log_vec *)&prev->data[c * chunk_units];
+        tasvir_log_vec val = *ptr;
+        tasvir_log_vec val_prev = *ptr_prev;
+        *(tasvir_log_vec *)&next->data[c * chunk_units] = retry ? val : val | val_prev;
+        *ptr_prev = retry ? val | val_prev : val;
+        *ptr = (tasvir_log_vec){0};
+        tasvir_log_summary_set(next->summary, c, c);
+        if (tasvir_log_vec_is_zero(ptr_prev))
+            tasvir_log_summary_clear(prev->summary, c, c);
+        else
+            tasvir_log_summary_set(prev->summary, c, c);
+        nr_merged++;
+    }
+    if (nr_chunks)
+        tasvir_log_summary_clear(summary, summary_base, summary_base + nr_chunks - 1);
+    return nr_merged;
+}
 
-    size_t seen = 0;
-    size_t offset;
-    size_t job_bytes = ttld.ndata->job_bytes;
+TASVIR_ISA_DISPATCH(static, size_t, tasvir_epoch_handoff_log,
+                    (tasvir_log_t *__restrict log, tasvir_log_t *__restrict summary, size_t summary_base,
+                     tasvir_area_log *__restrict prev, tasvir_area_log *__restrict next, size_t nr_chunks, bool retry),
+                    (log, summary, summary_base, prev, next, nr_chunks, retry))
 
-    tasvir_area_header *__restrict h_rw = tasvir_data2rw(d->h);
+/* clear the hand-off log and tell whether any of its lines were logged again while it was being copied */
+TASVIR_INLINE bool tasvir_epoch_verify_log_impl(const tasvir_log_t *__restrict log, tasvir_area_log *__restrict next,
+                                                size_t nr_chunks) {
+    const size_t chunk_units = 1 << (TASVIR_SHIFT_SUMMARY - TASVIR_SHIFT_UNIT);
+    tasvir_log_vec overlap = {0};
+    for (size_t c = 0; c < nr_chunks; c++) {
+        c = tasvir_log_summary_next(next->summary, c, nr_chunks);
+        if (c >= nr_chunks)
+            break;
+        tasvir_log_vec *ptr_next = (tasvir_log_vec *)&next->data[c * chunk_units];
+        overlap |= *ptr_next & *(const tasvir_log_vec *)&log[c * chunk_units];
+        *ptr_next = (tasvir_log_vec){0};
+    }
+    if (nr_chunks)
+        tasvir_log_summary_clear(next->summary, 0, nr_chunks - 1);
+    return !tasvir_log_vec_is_zero(&overlap);
+}
+
+TASVIR_ISA_DISPATCH(static, bool, tasvir_epoch_verify_log,
+                    (const tasvir_log_t *__restrict log, tasvir_area_log *__restrict next, size_t nr_chunks),
+                    (log, next, nr_chunks))
 
-    while (!j->done_stage1 &&
-           (offset = atomic_fetch_add_explicit(&j->offset, job_bytes, memory_order_relaxed)) < d->offset_log_end) {
-        size_t len = MIN(job_bytes, d->offset_log_end - offset);
+/* copy the lines of the hand-off log of epoch area d into the copy that no reader sees, resuming at the cursor kept
+ * in the hand-off state. with a nonzero end_tsc it stops between slices once end_tsc passed and saves the cursor.
+ * returns whether the whole log was copied.
+ */
+static bool tasvir_epoch_copy(const tasvir_area_desc *__restrict d, const tasvir_area_header *__restrict h_rw,
+                              uint64_t *state, uint64_t end_tsc) {
+    tasvir_area_log next = tasvir_epoch_log(h_rw, 1);
+    size_t chunk_bytes = 1UL << (tasvir_area_log_shift(d) + TASVIR_SHIFT_SUMMARY - TASVIR_SHIFT_BIT);
+    size_t slice = end_tsc ? TASVIR_ALIGNX(ttld.ndata->task_bytes_min, chunk_bytes) : d->offset_log_end;
+    size_t offset_start = (*state >> TASVIR_EPOCH_CURSOR_SHIFT) * chunk_bytes;
+    size_t offset = offset_start;
+    size_t updated = 0;
+    ttld.tdata->sync_list.to_spare = !(h_rw->epoch_ & 1);
+    ttld.tdata->sync_list.from_log = &next;
+    while (offset < d->offset_log_end) {
+        size_t len = MIN(slice, d->offset_log_end - offset);
         tasvir_sync_parse_log(d, offset, len, 0);
-        seen += len;
+        updated += tasvir_sync_process_changes(NULL, true, false);
+        offset += len;
+        if (end_tsc && __rdtsc() > end_tsc)
+            break;
     }
+    ttld.tdata->sync_list.from_log = NULL;
+    ttld.tdata->sync_list.to_spare = false;
+    bool done = offset >= d->offset_log_end;
+    *state &= (1UL << TASVIR_EPOCH_CURSOR_SHIFT) - 1;
+    if (!done)
+        *state |= offset / chunk_bytes << TASVIR_EPOCH_CURSOR_SHIFT;
+
+#ifdef TASVIR_DAEMON
+    ttld.ndata->stats_cur.isync_changed_bytes += updated;
+    ttld.ndata->stats_cur.isync_processed_bytes += offset - offset_start;
+#endif
+    return done;
+}
+
+/* make the copy that no reader sees the published one */
+static void tasvir_epoch_publish(const tasvir_area_desc *__restrict d, tasvir_area_header *__restrict h_rw) {
+    tasvir_area_header *__restrict h_cur = tasvir_data2pub(d, d->h);
+    tasvir_area_header *__restrict h_pub = h_rw->epoch_ & 1 ? tasvir_data2ro(d->h) : tasvir_data2spare(d->h);
+    /* external sync keeps its progress in the published header */
+    memcpy(h_pub->diff_log, h_cur->diff_log, sizeof(h_pub->diff_log));
+    tasvir_sync_publish_header(d, h_rw, h_pub);
+    h_pub->epoch_ = h_rw->epoch_ + 1;
+    __atomic_store_n(&h_rw->epoch_, h_pub->epoch_, __ATOMIC_SEQ_CST);
+    h_rw->epoch_retire_ = atomic_fetch_add(&ttld.ndata->epoch, 1) + 1;
+    h_rw->epoch_us_ = ttld.tdata->time_us;
+    if (h_rw->flags_ & TASVIR_AREA_FLAG_EXT_ENQUEUE)
+        h_rw->flags_ &= ~TASVIR_AREA_FLAG_EXT_ENQUEUE;
+    tasvir_wake_waiters(d);
+}
 
-    if (!seen)
+/* publish the changes of epoch area d through the copy that no reader sees.
+ * with sync helpers running, the writer only hands the logged lines off and keeps writing while a helper copies them.
+ * at its next service it publishes if none of them was written meanwhile, and otherwise copies those lines itself;
+ * without helpers, a writer with a sync budget copies over as many services as it takes before checking the same way.
+ * either way readers only ever see a copy that matches the writer copy at the time of a hand-off.
+ */
+static bool tasvir_sync_epoch_area(const tasvir_area_desc *__restrict d) {
+    tasvir_area_header *__restrict h_rw = tasvir_data2rw(d->h);
+    uint64_t state = __atomic_load_n(&h_rw->epoch_lock_, __ATOMIC_ACQUIRE);
+    if (h_rw->flags_ & (TASVIR_AREA_FLAG_EXT_PENDING | TASVIR_AREA_FLAG_SLEEPING) ||
+        (state & TASVIR_EPOCH_HANDOFF && ttld.ndata->nr_helpers))
         return false;
 
-    if (!j->done_stage1)
-        j->done_stage1 = true;
+    size_t nr_chunks = d->offset_log_end >> (tasvir_area_log_shift(d) + TASVIR_SHIFT_SUMMARY - TASVIR_SHIFT_BIT);
+    size_t summary_base = tasvir_data2summarybit((uintptr_t)d->h);
+    tasvir_log_t *summary = (tasvir_log_t *)TASVIR_ADDR_LOG_SUMMARY;
+    tasvir_log_t *log = tasvir_data2log(d->h);
+    tasvir_area_log prev = tasvir_epoch_log(h_rw, 0);
+    tasvir_area_log next = tasvir_epoch_log(h_rw, 1);
+    uint64_t end_tsc = d->sync_budget_us ? __rdtsc() + tasvir_usec2tsc(d->sync_budget_us) : 0;
 
-    size_t updated = tasvir_sync_process_changes(NULL, true, false);
-    if (updated)
-        atomic_fetch_add_explicit(&j->bytes_updated, updated, memory_order_relaxed);
+    if (!(state & (TASVIR_EPOCH_HANDOFF | TASVIR_EPOCH_COPIED))) {
+        if (ttld.tdata->time_us - h_rw->epoch_us_ < d->sync_int_us ||
+            tasvir_log_summary_next(summary, summary_base, summary_base + nr_chunks) == summary_base + nr_chunks)
+            return false;
 
-    if (seen + atomic_fetch_add(&j->bytes_seen, seen) == d->offset_log_end) {
-        if (h_rw->flags_ & TASVIR_AREA_FLAG_EXT_ENQUEUE)
-            h_rw->flags_ &= ~TASVIR_AREA_FLAG_EXT_ENQUEUE;
-        bool has_changes = updated || atomic_load_explicit(&j->bytes_updated, memory_order_relaxed);
-        if (has_changes) {
-            tasvir_area_header *__restrict h_ro = tasvir_data2ro(d->h);
-            h_ro->flags_ = h_rw->flags_ & (TASVIR_AREA_FLAG_ACTIVE | TASVIR_AREA_FLAG_LOCAL);
-            if (is_local) {
-                h_ro->time_us = h_ro->diff_log[0].end_us = h_rw->time_us = h_rw->diff_log[0].end_us =
-                    ttld.ndata->time_us;
-                h_ro->version = h_ro->diff_log[0].version_end = h_rw->diff_log[0].version_end = h_rw->version;
-                ++h_rw->version;
-                *h_rw->diff_log[0].data |= 1UL << 62; /* mark second cacheline modified */
-#ifdef TASVIR_DEBUG_PRINT_VIEWS
-                LOG_DBG("d=%s v_rw=%lu v_ro=%lu", d->name, h_rw->version, h_ro->version);
-#endif
-            }
-        } else if (!j->done_stage3) {
-            j->done_stage3 = true;
+        /* the unpublished copy is free once every other running thread announced an epoch after its retirement */
+        for (size_t tid = 0; tid < TASVIR_NR_THREADS_LOCAL; tid++) {
+            tasvir_local_tdata *tdata = &ttld.ndata->tdata[tid];
+            /* parked threads map the published copy before they read again */
+            if (tdata != ttld.tdata && tdata->state == TASVIR_THREAD_STATE_RUNNING && !atomic_load(&tdata->parked) &&
+                tdata->epoch < h_rw->epoch_retire_)
+                return false;
+        }
+
+        if (!tasvir_epoch_trylock(h_rw, &state))
+            return false;
+        tasvir_epoch_handoff_log(log, summary, summary_base, &prev, &next, nr_chunks, false);
+        if (ttld.ndata->nr_helpers || !tasvir_epoch_copy(d, h_rw, &state, end_tsc)) {
+            tasvir_epoch_unlock(h_rw, state | TASVIR_EPOCH_HANDOFF);
+            return false;
+        }
+    } else {
+        if (!tasvir_epoch_trylock(h_rw, &state))
+            return false;
+        /* resume a copy cut short by the budget, or the helpers are gone before copying what was handed off */
+        if (state & TASVIR_EPOCH_HANDOFF && !tasvir_epoch_copy(d, h_rw, &state, end_tsc)) {
+            tasvir_epoch_unlock(h_rw, state);
+            return false;
+        }
+        if (tasvir_epoch_verify_log(log, &next, nr_chunks)) {
+            /* some lines changed under the copy but they are all logged again, so copy them while quiescent */
+            tasvir_epoch_handoff_log(log, summary, summary_base, &prev, &next, nr_chunks, true);
+            tasvir_epoch_copy(d, h_rw, &state, 0);
         }
-        j->done_stage2 = true;
     }
 
-    return j->done_stage2;
+    tasvir_epoch_verify_log(log, &next, nr_chunks);
+    tasvir_epoch_publish(d, h_rw);
+    tasvir_epoch_unlock(h_rw, state & ~(TASVIR_EPOCH_HANDOFF | TASVIR_EPOCH_COPIED));
+    return true;
 }
 
-static bool tasvir_sync_internal_job_postprocess(tasvir_sync_job *j) {
-    if (j->done_stage3)
-        return true;
+/* copy what the writer of epoch area d handed off so it can publish at its next service */
+static bool tasvir_sync_epoch_area_helper(const tasvir_area_desc *__restrict d) {
+    tasvir_area_header *__restrict h_rw = tasvir_data2rw(d->h);
+    uint64_t state;
+    if (!(__atomic_load_n(&h_rw->epoch_lock_, __ATOMIC_ACQUIRE) & TASVIR_EPOCH_HANDOFF) ||
+        !tasvir_epoch_trylock(h_rw, &state))
+        return false;
+    bool copy = state & TASVIR_EPOCH_HANDOFF;
+    if (copy)
+        tasvir_epoch_copy(d, h_rw, &state, 0);
+    tasvir_epoch_unlock(h_rw, copy ? (state & ~TASVIR_EPOCH_HANDOFF) | TASVIR_EPOCH_COPIED : state);
+    return copy;
+}
 
-    const tasvir_area_desc *__restrict d = j->d;
-    bool is_local_writer = d->owner == ttld.thread;
-    if (!is_local_writer)
+/* publish the epoch areas this thread writes, map the latest copies of the others, and announce the epoch read */
+bool tasvir_sync_epoch() {
+    size_t epoch = atomic_load(&ttld.ndata->epoch);
+    bool changed = false;
+    for (size_t i = 0; i < ttld.node->nr_areas; i++) {
+        const tasvir_area_desc *d = ttld.node->areas_d[i];
+        if (!d || !d->h || !(d->opts & TASVIR_AREA_OPT_EPOCH))
+            continue;
+        bool is_writer = d->owner == ttld.thread;
 #ifdef TASVIR_DAEMON
-        is_local_writer = !tasvir_area_is_local(d);
-#else
-        return true;
+        if (!is_writer)
+            is_writer = !tasvir_area_is_local(d);
 #endif
-    if (is_local_writer) {
-        /* FIXME: adjust thresholds per uarch
-         * here I should really only reclaim modified lines but tracking them is a bit hard
-         */
-        size_t log_units = d->offset_log_end >> TASVIR_SHIFT_UNIT;
-        size_t log_bytes = log_units * sizeof(tasvir_log_t);
-        /* FIXME: 512KB was experimentally set here but likely function of L2 size and uarch-dependent */
-        if (log_bytes < 512 * KB) {
-            const size_t jump = TASVIR_CACHELINE_BYTES / sizeof(tasvir_log_t);
-            tasvir_log_t *log = tasvir_data2log(d->h);
-            for (size_t i = 0; i < log_units; i += jump)
-                _mm_prefetch(log + i, _MM_HINT_T1);
-        }
-        j->done_stage3 = true;
+        if (ttld.tdata->is_helper)
+            changed |= tasvir_sync_epoch_area_helper(d);
+        changed |= is_writer ? tasvir_sync_epoch_area(d) : tasvir_area_map_published(d);
     }
-
-    return j->done_stage3;
+    __atomic_store_n(&ttld.tdata->epoch, epoch, __ATOMIC_RELEASE);
+    return changed;
 }
 
 static bool tasvir_barrier_wait() {
@@ -255,10 +964,16 @@ static bool tasvir_barrier_wait() {
         return false;
     }
 
-    /* last thread */
-    if (atomic_fetch_sub(&ttld.ndata->barrier_cnt, 1) == 1) {
-        /* (A) if CAS fails another thread must have timed out and caused the barrier to fail, so comply! */
-        return atomic_compare_exchange_strong(&ttld.ndata->barrier_seq, &seq, seq + 1);
+    /* climb the tree while being the last to arrive at a node */
+    tasvir_barrier_node *node = &ttld.ndata->barrier_nodes[ttld.tdata->barrier_node];
+    while (atomic_fetch_sub(&node->nr_left, 1) == 1) {
+        node->done_tsc = __rdtsc();
+        /* last thread */
+        if (node->level == TASVIR_BARRIER_LEVELS - 1) {
+            /* (A) if CAS fails another thread must have timed out and caused the barrier to fail, so comply! */
+            return atomic_compare_exchange_strong(&ttld.ndata->barrier_seq, &seq, seq + 1);
+        }
+        node = &ttld.ndata->barrier_nodes[node->parent];
     }
 
     /* wait until success or timeout */
@@ -290,6 +1005,7 @@ int tasvir_sync_internal() {
         ttld.ndata->stats_cur.isync_failure++;
         ttld.ndata->stats_cur.isync_barrier_us += ttld.ndata->last_sync_int_end - ttld.ndata->last_sync_int_start;
         ttld.ndata->stats_cur.isync_us += ttld.ndata->last_sync_int_end - ttld.ndata->last_sync_int_start;
+        atomic_fetch_add(&ttld.ndata->sync_int_round, 1);
 #endif
         ttld.tdata->prev_sync_seq = ttld.tdata->next_sync_seq;
         return -1;
@@ -298,22 +1014,33 @@ int tasvir_sync_internal() {
 #ifdef TASVIR_DAEMON
     uint64_t time_us = tasvir_time_us();
     ttld.ndata->stats_cur.isync_barrier_us += time_us - ttld.ndata->last_sync_int_start;
-    ttld.ndata->sync_req = false;
+    uint64_t level_tsc[TASVIR_BARRIER_LEVELS] = {0};
+    for (size_t i = 0; i < ttld.ndata->nr_barrier_nodes; i++) {
+        const tasvir_barrier_node *node = &ttld.ndata->barrier_nodes[i];
+        level_tsc[node->level] = MAX(level_tsc[node->level], node->done_tsc);
+    }
+    uint64_t start_tsc = ttld.ndata->barrier_end_tsc - tasvir_usec2tsc(TASVIR_BARRIER_ENTER_US);
+    for (int level = 0; level < TASVIR_BARRIER_LEVELS; level++)
+        ttld.ndata->stats_cur.isync_barrier_level_us[level] += tasvir_tsc2usec(level_tsc[level] - start_tsc);
+    /* a requested sync is done once its last domain is under way */
+    if (ttld.ndata->sync_req_round && !ttld.ndata->nr_sync_deferred)
+        ttld.ndata->sync_req = false;
 #endif
 
     tasvir_sync_job *__restrict jobs = ttld.ndata->jobs;
     size_t nr_jobs = ttld.ndata->nr_jobs;
-    bool done[TASVIR_NR_SYNC_JOBS] = {0};
-    bool done_all = false;
-    while (!done_all) {
-        done_all = true;
-        for (cur_job = 0; cur_job < nr_jobs; cur_job++) {
-            tasvir_sync_job *__restrict j = &jobs[cur_job];
-            if (!done[cur_job])
-                done[cur_job] = tasvir_sync_internal_job(j) && tasvir_sync_internal_job_postprocess(j);
-            done_all &= done[cur_job];
-        }
-    }
+    tasvir_track_jobs(jobs, nr_jobs);
+    tasvir_sync_task *t;
+    while ((t = tasvir_sync_task_take(ttld.tdata, false)) || (t = tasvir_sync_task_steal()))
+        tasvir_sync_internal_task(t);
+    /* the others are busy with their last tasks */
+    while (atomic_load_explicit(&ttld.ndata->nr_tasks_left, memory_order_acquire))
+        _mm_pause();
+    /* pinned snapshots switch to the pages saved before this sync overwrote them */
+    if (ttld.nr_pins)
+        tasvir_snapshot_remap();
+    for (cur_job = 0; cur_job < nr_jobs; cur_job++)
+        tasvir_sync_internal_job_postprocess(&jobs[cur_job]);
 
     ttld.tdata->time_us = tasvir_time_us();
     ttld.tdata->prev_sync_seq = ttld.tdata->next_sync_seq;
@@ -326,9 +1053,11 @@ int tasvir_sync_internal() {
     /* update statistics */
     ttld.ndata->stats_cur.isync_success++;
     ttld.ndata->stats_cur.isync_us += ttld.tdata->time_us - time_us;
+    tasvir_sched_feedback(time_us - ttld.ndata->last_sync_int_start, ttld.ndata->last_sync_int_end - time_us);
     for (cur_job = 0; cur_job < nr_jobs; cur_job++) {
         ttld.ndata->stats_cur.isync_changed_bytes += jobs[cur_job].bytes_updated;
         ttld.ndata->stats_cur.isync_processed_bytes += jobs[cur_job].bytes_seen;
+        ttld.ndata->stats_cur.isync_suppressed_bytes += jobs[cur_job].bytes_suppressed;
     }
 
     uint64_t end_tsc = __rdtsc() + tasvir_usec2tsc(ttld.node->heartbeat_us);
@@ -350,6 +1079,7 @@ int tasvir_sync_internal() {
             }
         }
     }
+    atomic_fetch_add(&ttld.ndata->sync_int_round, 1);
 #endif
 
     return 0;
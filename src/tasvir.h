@@ -21,6 +21,35 @@
 #include <tasvir/tasvir.h>
 
 #define TASVIR_SYNC_LIST_LEN 512
+#define TASVIR_SYNC_REGION_BYTES (2UL << 20) /* internal sync copies regions of this size whole when they are dense */
+#define TASVIR_SYNC_DENSE_PCT 75             /* share (percent) of changed lines that makes a region dense */
+#define TASVIR_MSG_MEM_BYTES (TASVIR_CACHELINE_BYTES * TASVIR_NR_CACHELINES_PER_MSG) /* payload in the first segment */
+#define TASVIR_MSG_SEG_BYTES RTE_MBUF_DEFAULT_DATAROOM /* payload in each segment chained to a memory message */
+#define TASVIR_MSG_MEM_ENC_MAX (1UL << 20) /* bytes of memory an encoded memory message may cover */
+#define TASVIR_NR_BARRIER_NODES (TASVIR_BARRIER_LEVELS * TASVIR_NR_THREADS_LOCAL)
+#define TASVIR_SNAPSHOT_PAGES_MAX ((4UL << 30) / TASVIR_PAGE_BYTES) /* pages of the largest area that can be pinned */
+
+/* epoch_lock_ of epoch areas: the lock bit and the state of the copy handed off to a sync helper */
+#define TASVIR_EPOCH_LOCKED (1UL << 0)
+#define TASVIR_EPOCH_HANDOFF (1UL << 1) /* the lines to copy are in the hand-off log */
+#define TASVIR_EPOCH_COPIED (1UL << 2)  /* a helper copied them and the writer may verify and publish */
+#define TASVIR_EPOCH_CURSOR_SHIFT (8)   /* the rest counts the log chunks a budgeted copy is done with */
+
+/* instruction sets with dedicated variants of the sync kernels, ordered by preference */
+typedef enum {
+    TASVIR_ISA_SSE4 = 0,
+    TASVIR_ISA_AVX2,
+    TASVIR_ISA_AVX512,
+    TASVIR_NR_ISA,
+} tasvir_isa;
+
+typedef enum {
+    TASVIR_COPY_STORE = 0, /* temporal vector stores */
+    TASVIR_COPY_STREAM,    /* non-temporal vector stores that bypass the cache */
+    TASVIR_COPY_MOVSB,     /* rep movsb on cpus with enhanced fast strings (erms) */
+    TASVIR_COPY_PREFETCH,  /* temporal vector stores with the source prefetched ahead */
+    TASVIR_NR_COPY,
+} tasvir_copy_kernel;
 
 typedef enum {
     TASVIR_THREAD_STATE_INVALID = 0,
@@ -52,6 +81,7 @@ struct tasvir_thread { /* thread context */
 struct tasvir_node { /* node context */
     tasvir_nid nid;
     uint32_t heartbeat_us;
+    uint32_t mtu; /* MTU of the port of the daemon; messages of an area fit the smallest among its users */
     tasvir_thread threads[TASVIR_NR_THREADS_LOCAL];
     size_t nr_areas;
     tasvir_area_desc *areas_d[TASVIR_NR_AREAS];
@@ -66,18 +96,22 @@ typedef enum {
     TASVIR_AREA_FLAG_EXT_PENDING = 1 << 4, /* incoming external sync ongoing */
     TASVIR_AREA_FLAG_EXT_IGNORE = 1 << 5,  /* incoming external sync to be ignored */
     TASVIR_AREA_FLAG_EXT_ENQUEUE = 1 << 6, /* incoming external sync to be queued */
+    TASVIR_AREA_FLAG_SCHEDULED = 1 << 7,   /* in the internal sync schedule of the daemon */
+    TASVIR_AREA_FLAG_EXT_LAST = 1 << 8,    /* last message of the incoming external sync arrived */
 } tasvir_area_cache_flag;
 
 typedef enum {
     TASVIR_MSG_TYPE_INVALID = 0,
     TASVIR_MSG_TYPE_MEM,
     TASVIR_MSG_TYPE_RPC_REQUEST,
-    TASVIR_MSG_TYPE_RPC_RESPONSE
+    TASVIR_MSG_TYPE_RPC_RESPONSE,
+    TASVIR_MSG_TYPE_MEM_NACK
 } tasvir_msg_type;
 
 typedef struct tasvir_msg tasvir_msg;
 typedef struct tasvir_msg_rpc tasvir_msg_rpc;
 typedef struct tasvir_msg_mem tasvir_msg_mem;
+typedef struct tasvir_msg_nack tasvir_msg_nack;
 
 struct __attribute__((__packed__)) tasvir_msg {
     struct {
@@ -112,8 +146,10 @@ struct __attribute__((__packed__)) tasvir_msg_mem {
     void *addr;
     size_t len;
     uint8_t last;
-    uint64_t prev_bytes;
-    uint8_t pad_[23];
+    uint32_t seq;     /* position in the messages of this version of the area */
+    uint8_t resent;   /* sent again on request */
+    uint16_t enc_len; /* bytes of line holding the zero-run encoded payload; 0 for a raw payload */
+    uint8_t pad_[24];
     tasvir_cacheline line[TASVIR_NR_CACHELINES_PER_MSG];  // __attribute__((aligned(TASVIR_CACHELINE_BYTES)));
 };
 
@@ -123,6 +159,38 @@ TASVIR_STATIC_ASSERT(offsetof(tasvir_msg_mem, line[TASVIR_NR_CACHELINES_PER_MSG]
 TASVIR_STATIC_ASSERT(offsetof(tasvir_msg_mem, line) % TASVIR_CACHELINE_BYTES == 0,
                      "tasvir_msg_mem.line is not cacheline-aligned");
 
+/* frame bytes ahead of the payload, and the payload of a memory message at a given MTU */
+#define TASVIR_MSG_MEM_HDR_BYTES (offsetof(tasvir_msg_mem, line) - offsetof(tasvir_msg, eh))
+#define TASVIR_MSG_MEM_MTU_BYTES(mtu) \
+    (((mtu) + sizeof(struct ether_header) - TASVIR_MSG_MEM_HDR_BYTES) / TASVIR_CACHELINE_BYTES * TASVIR_CACHELINE_BYTES)
+
+/* sent by a subscriber to the daemon of the writer to ask for the memory messages [seq_start, seq_end) of a version */
+struct __attribute__((__packed__)) tasvir_msg_nack {
+    tasvir_msg h;
+    uint32_t seq_start;
+    uint32_t seq_end;
+};
+
+/* a memory message recently sent by the daemon, kept to send it again if a subscriber missed it */
+typedef struct tasvir_ext_frame {
+    const tasvir_area_desc *d;
+    uint64_t version;
+    void *addr;
+    uint32_t len;
+    uint32_t seq;
+    bool last;
+} tasvir_ext_frame;
+
+/* memory messages of an incoming version that the daemon found missing and asked for */
+typedef struct tasvir_ext_gap {
+    const tasvir_area_desc *d; /* NULL for a free slot */
+    uint64_t version;
+    uint32_t seq_start;
+    uint32_t seq_end;
+    uint64_t nack_us; /* time of the last request */
+    int nr_nacks;
+} tasvir_ext_gap;
+
 typedef struct tasvir_local_tdata tasvir_local_tdata;
 typedef struct tasvir_local_ndata tasvir_local_ndata;
 typedef struct tasvir_sync_job tasvir_sync_job;
@@ -140,23 +208,93 @@ typedef enum {
 /* set prior to sync by daemon and concurrently updated by all during sync */
 struct __attribute__((aligned(TASVIR_CACHELINE_BYTES))) tasvir_sync_job {
     tasvir_area_desc *d;
-    bool self_sync;
-    bool done_stage1;  // walking the log
-    bool done_stage2;  // updating the header
-    bool done_stage3;  // postprocessing
-    atomic_size_t offset __attribute__((aligned(TASVIR_CACHELINE_BYTES)));
+    bool done_stage0;                                                             // tracking dirty pages
+    atomic_size_t nr_tasks_left __attribute__((aligned(TASVIR_CACHELINE_BYTES))); // last one updates the header
     atomic_size_t bytes_seen;
     atomic_size_t bytes_updated;
+    atomic_size_t bytes_suppressed;
 };
 
+/* next internal sync of an area; the daemon keeps these in a min-heap */
+typedef struct tasvir_sync_deadline {
+    uint64_t due_us;
+    tasvir_area_desc *d;
+} tasvir_sync_deadline;
+
+/* sync intervals the daemon adapts for an area with a sync_overhead_pct */
+typedef struct tasvir_sync_ctl {
+    const tasvir_area_desc *d; /* NULL for a free slot */
+    uint64_t int_us;           /* internal sync interval in use */
+    uint64_t ext_us;           /* external sync interval in use */
+    uint64_t last_int_us;      /* time of the last internal sync */
+    double rate;               /* changed bytes per microsecond, smoothed */
+    double ext_cost_us;        /* time of an external sync, smoothed */
+} tasvir_sync_ctl;
+
+/* a container whose areas were all scheduled, so that the scheduler only looks at them again once it grows */
+typedef struct tasvir_sched_scan {
+    const tasvir_area_desc *c; /* NULL for a container to scan again */
+    size_t nr_areas;           /* areas of c at the last scan */
+    bool has_containers;       /* some of them are containers with their own scan */
+} tasvir_sched_scan;
+
+/* a pinned version of an area. the internal sync saves each page of the RO copy here before first overwriting it */
+typedef struct __attribute__((aligned(TASVIR_CACHELINE_BYTES))) tasvir_snapshot {
+    const tasvir_area_desc *_Atomic d; /* NULL for a free slot */
+    uint64_t version;
+    atomic_size_t nr_pins;  /* pins in all processes */
+    atomic_size_t nr_saved; /* pages saved so far */
+    atomic_uint_fast64_t saved[TASVIR_SNAPSHOT_PAGES_MAX / 64];
+} tasvir_snapshot;
+
+/* a snapshot mapped by this process: saved pages replace the RO pages as they appear */
+typedef struct tasvir_snapshot_map {
+    uint8_t *h; /* mapping of the area header; NULL for a free pin */
+    size_t slot;
+    size_t nr_remapped;
+    uint64_t *remapped; /* pages mapped from the slot */
+} tasvir_snapshot_map;
+
+/* a node of the combining tree of the sync barrier; the last child to arrive moves on to the parent */
+typedef struct __attribute__((aligned(TASVIR_CACHELINE_BYTES))) tasvir_barrier_node {
+    atomic_size_t nr_left; /* children yet to arrive */
+    size_t parent;
+    int level;         /* TASVIR_BARRIER_LEVELS - 1 at the root */
+    uint64_t done_tsc; /* arrival of the last child */
+} tasvir_barrier_node;
+
+/* online cost of the copy kernels for runs of one length class */
+typedef struct tasvir_copy_class {
+    uint32_t cycles_per_kb[TASVIR_NR_COPY]; /* moving average; 0 until tried */
+    uint32_t nr_copies;
+    tasvir_copy_kernel kernel; /* the cheapest so far */
+} tasvir_copy_class;
+
+/* a slice of a sync job; seeded into the task deque of a thread by daemon and taken by that thread or thieves */
+typedef struct tasvir_sync_task {
+    size_t offset;
+    size_t len;
+    uint32_t job;
+} tasvir_sync_task;
+
 typedef struct tasvir_sync_item {
-    uint64_t offset_scaled;
-    uint32_t len_scaled;
+    uint64_t offset; /* offset from the start of the data region */
+    uint64_t len;
 } tasvir_sync_item;
 
+typedef struct tasvir_log_range {
+    size_t bit_start; /* first log bit */
+    size_t bit_end;   /* last log bit (inclusive) */
+} tasvir_log_range;
+
 typedef struct __attribute__((aligned(TASVIR_CACHELINE_BYTES))) tasvir_sync_list {
     int changed;
     int cnt;
+    bool to_spare;                   /* copy changes into the spare copy rather than the RO copy */
+    bool to_replicas;                /* also copy changes into the replicas of the other sockets */
+    const tasvir_area_log *from_log; /* parse and keep this log instead of parsing and clearing the write log */
+    uint32_t snapshots;              /* save the RO pages about to change into these snapshot slots first */
+    size_t suppressed;               /* bytes logged but left out because the RO copy already had them */
     tasvir_sync_item l[TASVIR_SYNC_LIST_LEN];
 } tasvir_sync_list;
 
@@ -168,20 +306,38 @@ struct __attribute__((aligned(TASVIR_CACHELINE_BYTES))) tasvir_local_tdata { /*
     tasvir_thread_state state_req; /* state transition request by thread */
     size_t prev_sync_seq;          /* prev sync sequence number. updated by thread only. */
     size_t next_sync_seq;          /* next sync sequence number. updated by daemon only. */
+    size_t epoch;                  /* node epoch announced after mapping the latest published copies */
+    int socket;                    /* cpu socket of the thread */
+    int cpu;                       /* cpu the thread runs on */
+    int llc;                       /* last level cache of the cpu */
+    size_t barrier_node;           /* leaf of the barrier tree the thread arrives at */
+    bool is_helper;                /* a sync helper process that copies on behalf of epoch writers */
+    /* areas the thread attached to, hashed by tasvir_area_filter_bit; it sits out the syncs of other areas */
+    uint64_t areas_filter[TASVIR_NR_AREAS / 64];
+    /* set while the thread sleeps until wait_d reaches wait_version; it sits out syncs until its next service */
+    atomic_bool parked;
+    const tasvir_area_desc *wait_d;
+    uint64_t wait_version;
+    _Atomic uint32_t wake_seq; /* futex word bumped to wake the parked thread */
+    /* sync task deque: head in the upper half, tail in the lower; the thread pops the head, others steal the tail */
+    atomic_uint_fast64_t sync_tasks __attribute__((aligned(TASVIR_CACHELINE_BYTES)));
     tasvir_sync_list sync_list;
 };
 
 struct __attribute__((aligned(TASVIR_CACHELINE_BYTES))) tasvir_local_ndata { /* node data */
     uint64_t boot_us;
     uint64_t time_us;
-    uint64_t sync_int_us;
+    uint64_t sync_int_due_us; /* time of the next internal sync scheduling round */
     uint64_t sync_ext_us;
+    uint64_t sync_ext_adapt_us; /* shortest external sync interval picked for adaptive areas; 0 for none */
     double tsc2usec_mult;
     struct rte_mempool *mp;
 
     uint64_t barrier_end_tsc;
-    atomic_size_t barrier_cnt;
-    atomic_size_t barrier_seq;
+    /* waiting threads spin here so keep it apart from fields that change during the barrier */
+    atomic_size_t barrier_seq __attribute__((aligned(TASVIR_CACHELINE_BYTES)));
+    atomic_size_t epoch __attribute__((aligned(TASVIR_CACHELINE_BYTES))); /* advanced on every epoch publication */
+    atomic_size_t sync_int_round; /* odd from picking the threads of an internal sync until all of them are done */
     pthread_mutex_t mutex_init;
     struct rte_ring *ring_ext_tx;
     struct rte_ring *ring_mem_pending;
@@ -189,6 +345,8 @@ struct __attribute__((aligned(TASVIR_CACHELINE_BYTES))) tasvir_local_ndata { /*
     /* daemon data */
     struct ether_addr mac_addr;
     uint16_t port_id;
+    uint32_t mtu;         /* MTU of the port */
+    size_t msg_mem_bytes; /* payload of a memory message at the MTU of the port */
 
     /* special tids */
     tasvir_tid boot_tid;     // src tid before thread is initialized
@@ -204,10 +362,47 @@ struct __attribute__((aligned(TASVIR_CACHELINE_BYTES))) tasvir_local_ndata { /*
     tasvir_stats stats_cur;
     tasvir_stats stats;
 
+    /* sync thresholds calibrated at boot */
+    size_t self_sync_bytes;    /* areas smaller than this are synced by their writer */
+    size_t log_prefetch_bytes; /* the writer prefetches logs smaller than this after a sync */
+    size_t task_bytes_min;     /* lower bound of job_bytes */
+    size_t tasks_per_thread;   /* tasks per running thread to balance the work of a sync */
+    size_t nr_helpers;         /* running sync helpers; when nonzero they do the copies handed off by epoch writers */
+    atomic_size_t nr_parked;   /* threads sleeping in tasvir_wait_version */
+
+    /* internal sync schedule */
+    size_t nr_sync_deadlines;
+    tasvir_sync_deadline sync_deadlines[TASVIR_NR_AREAS];
+    uint64_t sync_threads; /* bit per local thread taking part in the current sync */
+    size_t nr_sync_deferred;
+    tasvir_area_desc *sync_deferred[TASVIR_NR_SYNC_JOBS]; /* areas of sync domains left for the next round */
+    bool sync_req_round;                                  /* the deferred domains finish a requested sync */
+    size_t nr_sync_dirty;                                 /* scheduled areas with a sync_dirty_bytes */
+    double sync_fixed_us;                                 /* barrier time of a round, smoothed */
+    double sync_us_per_byte;                              /* copy time per changed byte, smoothed */
+    tasvir_sync_ctl sync_ctl[TASVIR_NR_AREAS];            /* open addressing by tasvir_area_filter_bit */
+    tasvir_sched_scan sched_scans[TASVIR_NR_AREAS];       /* by tasvir_area_filter_bit of the container */
+
+    /* loss recovery of external sync */
+    size_t nr_ext_frames; /* memory messages sent so far; the last TASVIR_NR_EXT_FRAMES are kept */
+    tasvir_ext_frame ext_frames[TASVIR_NR_EXT_FRAMES];
+    size_t nr_ext_gaps;
+    tasvir_ext_gap ext_gaps[TASVIR_NR_EXT_GAPS];
+
+    /* pinned snapshots */
+    tasvir_snapshot snapshots[TASVIR_NR_SNAPSHOTS];
+
+    /* sync barrier tree */
+    size_t nr_barrier_nodes;
+    tasvir_barrier_node barrier_nodes[TASVIR_NR_BARRIER_NODES];
+
     /* sync jobs */
-    size_t job_bytes;
+    size_t job_bytes; /* bytes per task */
     size_t nr_jobs;
     tasvir_sync_job jobs[TASVIR_NR_SYNC_JOBS];
+    size_t nr_tasks;
+    atomic_size_t nr_tasks_left __attribute__((aligned(TASVIR_CACHELINE_BYTES)));
+    tasvir_sync_task tasks[TASVIR_NR_SYNC_TASKS];
 
     /* thread to daemon requests */
     bool node_init_req;
@@ -222,6 +417,8 @@ struct __attribute__((aligned(TASVIR_CACHELINE_BYTES))) tasvir_local_ndata { /*
 /* thread-internal data */
 struct __attribute__((aligned(4096))) tasvir_tls_data {
     double tsc2usec_mult;
+    tasvir_isa isa; /* sync kernel variants to use */
+    bool has_erms;  /* rep movsb is fast */
     tasvir_area_desc *root_desc; /* root area descriptor */
     tasvir_area_desc *node_desc; /* current node's area descriptor */
     tasvir_node *node;           /* current node's global data */
@@ -237,18 +434,38 @@ struct __attribute__((aligned(4096))) tasvir_tls_data {
     tasvir_fn_desc *ht_fnptr;
     tasvir_rpc_status status_l[TASVIR_NR_RPC_MSG];
 
+    size_t nr_log_batch;
+    tasvir_log_range log_batch[TASVIR_NR_LOG_BATCH]; /* staged ranges of tasvir_logv */
+
+    tasvir_copy_class copy_classes[TASVIR_NR_COPY_CLASSES]; /* copy kernel choice per run length */
+
+    bool track_init;
+    int pagemap_fd;    /* /proc/self/pagemap for soft-dirty bits */
+    int clear_refs_fd; /* /proc/self/clear_refs to reset soft-dirty bits */
+    int track_uffd;    /* userfaultfd that write-protects the tracked areas alone; -1 to use soft-dirty bits */
+
+    size_t nr_pins;
+    tasvir_snapshot_map pins[TASVIR_NR_SNAPSHOTS];
+
+    uint64_t wait_spin_us; /* adaptive spin time of tasvir_wait_version */
+    bool wait_init;
+    int wait_fd;       /* eventfd of tasvir_wait_version_fd */
+    uint32_t wait_seq; /* wake_seq last forwarded to wait_fd */
+
     bool is_root;
 } ttld; /* tasvir thread-local data */
 
 
 _Static_assert(sizeof(tasvir_local_ndata) <= TASVIR_SIZE_LOCAL,
                "TASVIR_SIZE_LOCAL smaller than sizeof(tasvir_local_ndata)");
+TASVIR_STATIC_ASSERT(TASVIR_NR_THREADS_LOCAL <= 64, "sync_threads holds one bit per local thread");
 
 /* function prototypes */
 
 tasvir_area_desc *tasvir_new_alloc_desc(tasvir_area_desc);
 int tasvir_area_add_user(tasvir_area_desc *, tasvir_node *, int);
 int tasvir_area_add_user_wait(uint64_t, tasvir_area_desc *, tasvir_node *, int);
+bool tasvir_area_map_published(const tasvir_area_desc *);
 tasvir_thread *tasvir_init_thread(pid_t);
 int tasvir_init_dpdk();
 void tasvir_init_rpc();
@@ -257,17 +474,31 @@ void tasvir_sched_sync_internal();
 int tasvir_handle_msg_rpc(tasvir_msg *, tasvir_msg_src);
 void tasvir_handle_msg_rpc_request(tasvir_msg_rpc *);
 void tasvir_handle_msg_rpc_response(tasvir_msg_rpc *);
+void tasvir_log_area(const tasvir_area_desc *, const void *, size_t);
+void tasvir_log_flush();
+void tasvir_log_map_update(const tasvir_area_desc *);
 size_t tasvir_sync_parse_log(const tasvir_area_desc *__restrict, size_t, size_t, int);
 size_t tasvir_sync_process_changes(const tasvir_area_desc *__restrict, bool, bool);
 int tasvir_sync_internal();
+bool tasvir_sync_epoch();
+void tasvir_wake(tasvir_local_tdata *);
+void tasvir_wake_waiters(const tasvir_area_desc *);
+void tasvir_snapshot_save(uint32_t, size_t, size_t);
+void tasvir_snapshot_remap();
+void tasvir_track_jobs(tasvir_sync_job *, size_t);
 
 #ifdef TASVIR_DAEMON
 int tasvir_init_port();
+void tasvir_init_tune();
 void tasvir_stats_update();
 void tasvir_handle_msg_mem(tasvir_msg_mem *);
+void tasvir_handle_msg_nack(tasvir_msg_nack *);
+size_t tasvir_msg_mem_populate(tasvir_msg_mem *, const tasvir_ext_frame *);
+void tasvir_service_nacks();
 void tasvir_service_port_tx();
 int tasvir_sync_external();
 size_t tasvir_sync_external_area(tasvir_area_desc *);
+tasvir_sync_ctl *tasvir_sched_ctl(const tasvir_area_desc *);
 #endif
 
 #include "utils.h"
@@ -0,0 +1,207 @@
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <linux/userfaultfd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "tasvir.h"
+
+#define TASVIR_PAGEMAP_SOFT_DIRTY (1UL << 55)
+#define TASVIR_PAGEMAP_BATCH (512) /* pagemap entries or written page ranges read per syscall */
+
+/* write-protect tracking through PAGEMAP_SCAN and asynchronous userfaultfd faults (linux 6.7) */
+#ifndef PAGEMAP_SCAN
+#define PAGE_IS_WRITTEN (1 << 1)
+#define PM_SCAN_WP_MATCHING (1 << 0)
+#define PM_SCAN_CHECK_WPASYNC (1 << 1)
+struct page_region {
+    __u64 start;
+    __u64 end;
+    __u64 categories;
+};
+struct pm_scan_arg {
+    __u64 size;
+    __u64 flags;
+    __u64 start;
+    __u64 end;
+    __u64 walk_end;
+    __u64 vec;
+    __u64 vec_len;
+    __u64 max_pages;
+    __u64 category_inverted;
+    __u64 category_mask;
+    __u64 category_anyof_mask;
+    __u64 return_mask;
+};
+#define PAGEMAP_SCAN _IOWR('f', 16, struct pm_scan_arg)
+#endif
+#ifndef UFFD_FEATURE_WP_ASYNC
+#define UFFD_FEATURE_WP_UNPOPULATED (1 << 13)
+#define UFFD_FEATURE_WP_ASYNC (1 << 15)
+#endif
+
+TASVIR_STATIC_ASSERT(TASVIR_PAGE_BYTES == 1 << TASVIR_SHIFT_UNIT, "dirty tracking expects one log unit per page");
+
+static void tasvir_track_init() {
+    ttld.track_init = true;
+    ttld.pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+    ttld.clear_refs_fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (ttld.pagemap_fd == -1 || ttld.clear_refs_fd == -1)
+        LOG_ERR("soft-dirty tracking unavailable (%s); falling back to comparing whole areas", strerror(errno));
+
+    /* the kernel resolves the write faults itself and only marks the pages written */
+    struct uffdio_api api = {.api = UFFD_API,
+                             .features = UFFD_FEATURE_WP_ASYNC | UFFD_FEATURE_WP_HUGETLBFS_SHMEM |
+                                         UFFD_FEATURE_WP_UNPOPULATED};
+    ttld.track_uffd = -1;
+    if (ttld.pagemap_fd != -1)
+        ttld.track_uffd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+    if (ttld.track_uffd != -1 && ioctl(ttld.track_uffd, UFFDIO_API, &api)) {
+        close(ttld.track_uffd);
+        ttld.track_uffd = -1;
+    }
+    if (ttld.track_uffd == -1)
+        LOG_INFO("write-protect tracking unavailable (%s); clearing the soft-dirty bits of the whole process instead",
+                 strerror(errno));
+}
+
+/* one log bit per cacheline that differs between the RW and RO copies of a page */
+TASVIR_INLINE tasvir_log_t tasvir_track_page_diff_impl(const uint8_t *__restrict page) {
+    const uint8_t *page_ro = tasvir_data2ro((void *)page);
+    tasvir_log_t diff = 0;
+    for (size_t i = 0; i < TASVIR_LOG_UNIT_BITS; i++) {
+        tasvir_log_vec v = *(const tasvir_log_vec *)(page + (i << TASVIR_SHIFT_BIT)) ^
+                           *(const tasvir_log_vec *)(page_ro + (i << TASVIR_SHIFT_BIT));
+        diff |= (tasvir_log_t)!tasvir_log_vec_is_zero(&v) << (TASVIR_LOG_UNIT_BITS - 1 - i);
+    }
+    return diff;
+}
+
+TASVIR_ISA_DISPATCH(static, tasvir_log_t, tasvir_track_page_diff, (const uint8_t *__restrict page), (page))
+
+/* compare the RW and RO copies of a page and log the lines that differ */
+static void tasvir_track_page(uint8_t *page, tasvir_log_t mask, bool is_default_granularity) {
+    tasvir_log_t diff = tasvir_track_page_diff(page) & mask;
+    if (diff && !is_default_granularity) {
+        /* the log bits of other granularities are not laid out per page, so go through the log map */
+        while (diff) {
+            int i = tasvir_clz64(diff);
+            tasvir_log(page + (i << TASVIR_SHIFT_BIT), 1 << TASVIR_SHIFT_BIT);
+            diff &= ~((1UL << (TASVIR_LOG_UNIT_BITS - 1)) >> i);
+        }
+    } else if (diff) {
+        tasvir_log_t *log = tasvir_data2log(page);
+        if ((*log | diff) != *log)
+            *log |= diff;
+        size_t summary_bit = tasvir_data2summarybit((uintptr_t)page);
+        tasvir_log_summary_set((tasvir_log_t *)TASVIR_ADDR_LOG_SUMMARY, summary_bit, summary_bit);
+    }
+}
+
+/* log the pages of [page, end) written since the last scan and write-protect them again. false if the range is not
+ * registered with our userfaultfd, such as before the first scan of the area.
+ */
+static bool tasvir_track_area_wp(uint8_t *page, uint8_t *end, uint8_t *data, tasvir_log_t mask_first,
+                                 bool is_default_granularity) {
+    struct page_region regions[TASVIR_PAGEMAP_BATCH];
+    struct pm_scan_arg arg = {.size = sizeof(arg),
+                              .flags = PM_SCAN_WP_MATCHING | PM_SCAN_CHECK_WPASYNC,
+                              .start = (uintptr_t)page,
+                              .end = (uintptr_t)end,
+                              .vec = (uintptr_t)regions,
+                              .vec_len = TASVIR_PAGEMAP_BATCH,
+                              .category_mask = PAGE_IS_WRITTEN,
+                              .return_mask = PAGE_IS_WRITTEN};
+    while (arg.start < arg.end) {
+        int nr_regions = ioctl(ttld.pagemap_fd, PAGEMAP_SCAN, &arg);
+        if (nr_regions < 0)
+            return false;
+        for (int i = 0; i < nr_regions; i++)
+            for (uint8_t *p = (uint8_t *)regions[i].start; p < (uint8_t *)regions[i].end; p += TASVIR_PAGE_BYTES)
+                tasvir_track_page(p, p < data ? mask_first : ~(tasvir_log_t)0, is_default_granularity);
+        arg.start = arg.walk_end;
+    }
+    return true;
+}
+
+/* turn dirty pages of an owned area into log bits; the area header is maintained with explicit logs.
+ * returns whether the soft-dirty bits were used, which then need clearing.
+ */
+static bool tasvir_track_area(const tasvir_area_desc *d) {
+    uint8_t *data = tasvir_data((tasvir_area_desc *)d);
+    uint8_t *page = (uint8_t *)((uintptr_t)data & ~(TASVIR_PAGE_BYTES - 1));
+    uint8_t *end = (uint8_t *)d->h + d->offset_log_end;
+    tasvir_log_t mask_first = ~(tasvir_log_t)0 >> ((data - page) >> TASVIR_SHIFT_BIT);
+    bool is_default_granularity = tasvir_area_log_shift(d) == TASVIR_SHIFT_BIT;
+    uint64_t pm[TASVIR_PAGEMAP_BATCH];
+
+    if (ttld.track_uffd != -1) {
+        if (tasvir_track_area_wp(page, end, data, mask_first, is_default_granularity))
+            return false;
+        /* register the area, or register it again after a remap; its first scan reports every page as written */
+        struct uffdio_register reg = {.range = {.start = (uintptr_t)page, .len = end - page},
+                                      .mode = UFFDIO_REGISTER_MODE_WP};
+        if (!ioctl(ttld.track_uffd, UFFDIO_REGISTER, &reg) &&
+            tasvir_track_area_wp(page, end, data, mask_first, is_default_granularity))
+            return false;
+        LOG_INFO("write-protect tracking failed (%s); clearing the soft-dirty bits of the whole process instead",
+                 strerror(errno));
+        close(ttld.track_uffd);
+        ttld.track_uffd = -1;
+    }
+
+    while (page < end) {
+        size_t nr_pages = MIN(TASVIR_PAGEMAP_BATCH, (size_t)(end - page) / TASVIR_PAGE_BYTES);
+        ssize_t pm_bytes = nr_pages * sizeof(pm[0]);
+        bool all_dirty = ttld.pagemap_fd == -1 ||
+                         pread(ttld.pagemap_fd, pm, pm_bytes, (uintptr_t)page / TASVIR_PAGE_BYTES * sizeof(pm[0])) !=
+                             pm_bytes;
+        for (size_t i = 0; i < nr_pages; i++) {
+            uint8_t *p = page + i * TASVIR_PAGE_BYTES;
+            if (all_dirty || pm[i] & TASVIR_PAGEMAP_SOFT_DIRTY)
+                tasvir_track_page(p, p < data ? mask_first : ~(tasvir_log_t)0, is_default_granularity);
+        }
+        page += nr_pages * TASVIR_PAGE_BYTES;
+    }
+    return true;
+}
+
+void tasvir_track_jobs(tasvir_sync_job *jobs, size_t nr_jobs) {
+    bool soft_dirty = false;
+    if (!ttld.track_init)
+        tasvir_track_init();
+
+    for (size_t i = 0; i < nr_jobs; i++) {
+        tasvir_sync_job *j = &jobs[i];
+        if (j->done_stage0 || j->d->owner != ttld.thread)
+            continue;
+        soft_dirty |= tasvir_track_area(j->d);
+        _mm_sfence();
+        j->done_stage0 = true;
+    }
+    /* write-protect tracking is per area, so only the soft-dirty fallback needs the rest of this */
+    if (!soft_dirty)
+        return;
+
+    /* the soft-dirty bits are per process, so our areas that are not due turn their dirty pages into log bits for
+     * their own round before the bits are cleared. their RO copies did not move so comparing against them holds.
+     */
+    for (size_t i = 0; i < ttld.node->nr_areas; i++) {
+        const tasvir_area_desc *d = ttld.node->areas_d[i];
+        if (d->owner != ttld.thread || !(d->opts & TASVIR_AREA_OPT_TRACK_AUTO) || d->opts & TASVIR_AREA_OPT_EPOCH ||
+            !tasvir_area_is_active_local(d))
+            continue;
+        size_t k = 0;
+        while (k < nr_jobs && jobs[k].d != d)
+            k++;
+        if (k == nr_jobs)
+            tasvir_track_area(d);
+    }
+
+    /* safe to reset now since the writer (us) is not writing during the sync. this write-protects every page of the
+     * process, so the heap and all other mappings take a fault on their next write as well.
+     */
+    if (ttld.clear_refs_fd != -1 && pwrite(ttld.clear_refs_fd, "4", 1, 0) != 1)
+        LOG_ERR("failed to clear soft-dirty bits (%s)", strerror(errno));
+}
@@ -0,0 +1,115 @@
+#ifdef TASVIR_DAEMON
+#include <cpuid.h>
+
+#include "tasvir.h"
+
+#define TASVIR_TUNE_BYTES_MIN (16 * 1024)         /* smallest copy size benchmarked */
+#define TASVIR_TUNE_BYTES_MAX (256 * 1024 * 1024) /* cap on the benchmark buffers */
+#define TASVIR_TUNE_BYTES_REP (64 * 1024 * 1024)  /* bytes copied per benchmarked size */
+
+/* sizes of the L2 and the last level data caches from the deterministic cache parameters leaf */
+static void tasvir_tune_cache_sizes(size_t *l2, size_t *llc) {
+    unsigned int eax, ebx, ecx, edx;
+    unsigned int leaf = 4;
+    __cpuid(0, eax, ebx, ecx, edx);
+    if (ebx == signature_AMD_ebx)
+        leaf = __get_cpuid_max(0x80000000, NULL) >= 0x8000001d ? 0x8000001d : 0;
+    else if (eax < 4)
+        leaf = 0;
+
+    for (unsigned int i = 0; leaf && i < 16; i++) {
+        __cpuid_count(leaf, i, eax, ebx, ecx, edx);
+        int type = eax & 0x1f;
+        int level = (eax >> 5) & 0x7;
+        if (!type)
+            break;
+        if (type == 2 || level < 2) /* instruction or L1 cache */
+            continue;
+        size_t bytes = (size_t)((ebx >> 22) + 1) * (((ebx >> 12) & 0x3ff) + 1) * ((ebx & 0xfff) + 1) * (ecx + 1);
+        if (level == 2)
+            *l2 = bytes;
+        *llc = bytes; /* levels are reported in ascending order */
+    }
+}
+
+/* bytes per cycle of the copy kernel used by the internal sync with len bytes in flight */
+static double tasvir_tune_copy_rate(uint8_t *dst, const uint8_t *src, size_t len) {
+    size_t reps = MAX(4, TASVIR_TUNE_BYTES_REP / len);
+    tasvir_store_vec_rep(dst, src, len);
+    uint64_t tsc = __rdtsc();
+    for (size_t i = 0; i < reps; i++) {
+        tasvir_store_vec_rep(dst, src, len);
+        __asm__ volatile("" ::: "memory");
+    }
+    return (double)(len * reps) / MAX(__rdtsc() - tsc, 1);
+}
+
+static void tasvir_tune_env(const char *name, size_t *val, size_t unit) {
+    char *env = getenv(name);
+    if (!env)
+        return;
+    char *end;
+    unsigned long v = strtoul(env, &end, 10);
+    if (*end || !v) {
+        LOG_ERR("ignoring %s=%s (expected a positive integer)", name, env);
+        return;
+    }
+    *val = v * unit;
+}
+
+/* calibrate the internal sync thresholds against the caches of this cpu; TASVIR_SELF_SYNC_KB,
+ * TASVIR_LOG_PREFETCH_KB, TASVIR_TASK_KB_MIN and TASVIR_TASKS_PER_THREAD override the results
+ */
+void tasvir_init_tune() {
+    size_t l2 = 1024 * 1024;
+    size_t llc = l2;
+    tasvir_tune_cache_sizes(&l2, &llc);
+    llc = MAX(llc, l2);
+
+    /* not measured: the log walked by the writer after a sync must leave room in L2 for the data it covers, and
+     * eight tasks per thread leave enough to steal when copy rates differ across threads
+     */
+    ttld.ndata->log_prefetch_bytes = l2 / 2;
+    ttld.ndata->self_sync_bytes = l2 / 2;
+    ttld.ndata->task_bytes_min = TASVIR_ALIGNMENT * 4;
+    ttld.ndata->tasks_per_thread = 8;
+
+    size_t buf_bytes = MIN(TASVIR_ALIGNX(2 * llc, TASVIR_PAGE_BYTES), TASVIR_TUNE_BYTES_MAX);
+    uint8_t *src = aligned_alloc(TASVIR_PAGE_BYTES, buf_bytes);
+    uint8_t *dst = aligned_alloc(TASVIR_PAGE_BYTES, buf_bytes);
+    if (src && dst) {
+        memset(src, 1, buf_bytes);
+        memset(dst, 0, buf_bytes);
+        /* an area is synced by its writer while copying it is as fast as from the writer's cache, up to the first
+         * size that falls below 3/4 of the peak; larger sizes that measure close to the peak again do not count
+         */
+        double rate_peak = 0, rate = 0;
+        bool fell = false;
+        for (size_t len = TASVIR_TUNE_BYTES_MIN; len <= buf_bytes; len *= 2) {
+            rate = tasvir_tune_copy_rate(dst, src, len);
+            rate_peak = MAX(rate_peak, rate);
+            if (!fell && rate >= rate_peak * 3 / 4)
+                ttld.ndata->self_sync_bytes = len;
+            else
+                fell = true;
+        }
+        /* tasks shorter than about a microsecond of copying out of memory are dominated by stealing them */
+        size_t task_bytes = rate / ttld.ndata->tsc2usec_mult;
+        while (ttld.ndata->task_bytes_min < task_bytes)
+            ttld.ndata->task_bytes_min *= 2;
+    } else {
+        LOG_ERR("failed to allocate %lu bytes for calibration; using defaults", buf_bytes);
+    }
+    free(src);
+    free(dst);
+
+    tasvir_tune_env("TASVIR_SELF_SYNC_KB", &ttld.ndata->self_sync_bytes, 1024);
+    tasvir_tune_env("TASVIR_LOG_PREFETCH_KB", &ttld.ndata->log_prefetch_bytes, 1024);
+    tasvir_tune_env("TASVIR_TASK_KB_MIN", &ttld.ndata->task_bytes_min, 1024);
+    tasvir_tune_env("TASVIR_TASKS_PER_THREAD", &ttld.ndata->tasks_per_thread, 1);
+    ttld.ndata->task_bytes_min = TASVIR_ALIGNX(ttld.ndata->task_bytes_min, TASVIR_ALIGNMENT);
+    LOG_INFO("l2=%luKB llc=%luKB self_sync<%luKB log_prefetch<%luKB task>=%luKB tasks_per_thread=%lu", l2 >> 10,
+             llc >> 10, ttld.ndata->self_sync_bytes >> 10, ttld.ndata->log_prefetch_bytes >> 10,
+             ttld.ndata->task_bytes_min >> 10, ttld.ndata->tasks_per_thread);
+}
+#endif
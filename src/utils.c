@@ -1,5 +1,18 @@
+#include <execinfo.h>
+#include <unistd.h>
+
 #include "tasvir.h"
 
+#define TASVIR_BACKTRACE_BUFSIZE 32
+
+void tasvir_backtrace_handler(int sig) {
+    void *buf[TASVIR_BACKTRACE_BUFSIZE];
+    int nptrs = backtrace(buf, TASVIR_BACKTRACE_BUFSIZE);
+    fprintf(stderr, "Error: received signal %d.\n", sig);
+    backtrace_symbols_fd(buf, nptrs, STDERR_FILENO);
+    exit(1);
+}
+
 void tasvir_hexdump(void *addr, size_t len) {
     uint8_t *b = (uint8_t *)addr;
     size_t i;
@@ -16,13 +29,15 @@ void tasvir_area_str(const tasvir_area_desc *d, char *buf, size_t buf_size) {
 
     snprintf(
         buf, buf_size,
-        "name=%s type=%s len=0x%lx sync_us=%lu/%lu boot_us=%lu nr_areas_max=%lu d=%p pd=%p owner=%p h=%p flags=0x%lx",
-        d->name, tasvir_area_type_str[d->type], d->len, d->sync_int_us, d->sync_ext_us, d->boot_us, d->nr_areas_max,
-        (void *)d, (void *)d->pd, (void *)d->owner, (void *)d->h, d->h ? d->h->flags_ : 0);
+        "name=%s type=%s len=0x%lx sync_us=%lu/%lu/%lu boot_us=%lu nr_areas_max=%lu opts=0x%x log_bytes=%u d=%p pd=%p "
+        "owner=%p h=%p flags=0x%lx",
+        d->name, tasvir_area_type_str[d->type], d->len, d->sync_int_us, d->sync_ext_us, d->sync_budget_us, d->boot_us,
+        d->nr_areas_max, d->opts, d->log_bytes, (void *)d, (void *)d->pd, (void *)d->owner, (void *)d->h,
+        d->h ? d->h->flags_ : 0);
 }
 
 void tasvir_msg_str(tasvir_msg *m, bool is_src_me, bool is_dst_me, char *buf, size_t buf_size) {
-    static const char *tasvir_msg_type_str[] = {"invalid", "mem", "rpc_request", "rpc_reply"};
+    static const char *tasvir_msg_type_str[] = {"invalid", "mem", "rpc_request", "rpc_reply", "mem_nack"};
     char direction;
     char src_str[48];
     char dst_str[48];
@@ -41,11 +56,16 @@ void tasvir_msg_str(tasvir_msg *m, bool is_src_me, bool is_dst_me, char *buf, si
 
         snprintf(buf, buf_size, "%c type=%s d=%s v=%lu id=%d %s->%s f=%s", direction, tasvir_msg_type_str[m->type],
                  m->d ? m->d->name : "root", m->version, m->id, src_str, dst_str, fnd->name);
+    } else if (m->type == TASVIR_MSG_TYPE_MEM_NACK) {
+        tasvir_msg_nack *mn = (tasvir_msg_nack *)m;
+        snprintf(buf, buf_size, "%c type=%s d=%s v=%lu id=%d %s->%s seq=%u-%u", direction,
+                 tasvir_msg_type_str[m->type], m->d->name, m->version, m->id, src_str, dst_str, mn->seq_start,
+                 mn->seq_end - 1);
     } else {
         tasvir_msg_mem *mm = (tasvir_msg_mem *)m;
-        snprintf(buf, buf_size, "%c type=%s d=%s v=%lu id=%d %s->%s addr=%p len=%lu last=%u", direction,
+        snprintf(buf, buf_size, "%c type=%s d=%s v=%lu id=%d %s->%s addr=%p len=%lu seq=%u last=%u", direction,
                  tasvir_msg_type_str[m->type], m->d->name, m->version, m->id, src_str, dst_str, mm->addr, mm->len,
-                 mm->last);
+                 mm->seq, mm->last);
     }
 #ifdef TASVIR_DEBUG_HEXDUMP
     tasvir_hexdump(&m->h.eh, m->h.mbuf.data_len);
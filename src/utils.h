@@ -88,6 +88,7 @@ static inline uint64_t tasvir_time_boot_us() { return tasvir_tsc2usec(__rdtsc())
 /* area */
 
 bool tasvir_area_is_active(const tasvir_area_desc *d);
+bool tasvir_area_is_active_local(const tasvir_area_desc *d);
 bool tasvir_area_is_local(const tasvir_area_desc *d);
 bool tasvir_area_is_mapped_rw(const tasvir_area_desc *d);
 typedef size_t (*tasvir_fnptr_walkcb)(tasvir_area_desc *);
@@ -96,11 +97,114 @@ size_t tasvir_area_walk(tasvir_area_desc *d, tasvir_fnptr_walkcb fnptr);
 /* memory map */
 
 static inline tasvir_log_t *tasvir_data2log(void *data) {
-    return (tasvir_log_t *)TASVIR_ADDR_LOG +
-           _pext_u64((uintptr_t)data, (TASVIR_SIZE_DATA - 1) & (~0UL << TASVIR_SHIFT_UNIT));
+    return (tasvir_log_t *)TASVIR_ADDR_LOG + (((uintptr_t)data & (TASVIR_SIZE_DATA - 1)) >> TASVIR_SHIFT_UNIT);
+}
+static inline size_t tasvir_data2summarybit(uintptr_t data) {
+    return tasvir_data2logbit(data) >> (TASVIR_SHIFT_SUMMARY - TASVIR_SHIFT_BIT);
+}
+static inline int tasvir_area_log_shift(const tasvir_area_desc *d) {
+    return d->log_bytes ? __builtin_ctz(d->log_bytes) : TASVIR_SHIFT_BIT;
 }
 static inline void *tasvir_data2ro(void *data) { return (uint8_t *)data + TASVIR_OFFSET_RO; }
 static inline void *tasvir_data2rw(void *data) { return (uint8_t *)data + TASVIR_OFFSET_RW; }
+static inline void *tasvir_data2spare(void *data) { return (uint8_t *)data + TASVIR_OFFSET_SPARE; }
+/* data in the replica of socket; socket 0 reads the RO copy */
+static inline void *tasvir_data2replica(void *data, int socket) {
+    return socket ? (uint8_t *)data + TASVIR_OFFSET_REPLICA + (socket - 1) * TASVIR_SIZE_DATA : tasvir_data2ro(data);
+}
+/* replica that readers of d in this process map */
+static inline int tasvir_area_replica(const tasvir_area_desc *d) {
+    if (!(d->opts & TASVIR_AREA_OPT_REPLICATE) || !ttld.tdata || ttld.tdata->socket >= TASVIR_NR_SOCKETS)
+        return 0;
+    return ttld.tdata->socket;
+}
+/* data in the copy of d that readers see: the spare copy on odd epochs of epoch areas and the RO copy otherwise */
+static inline void *tasvir_data2pub(const tasvir_area_desc *d, void *data) {
+    const tasvir_area_header *h_rw = tasvir_data2rw(d->h);
+    bool is_spare = (d->opts & TASVIR_AREA_OPT_EPOCH) && (__atomic_load_n(&h_rw->epoch_, __ATOMIC_ACQUIRE) & 1);
+    return is_spare ? tasvir_data2spare(data) : tasvir_data2ro(data);
+}
+/* bit of d in the areas_filter of threads; areas of one container map to distinct bits */
+static inline size_t tasvir_area_filter_bit(const tasvir_area_desc *d) {
+    return ((uintptr_t)d / sizeof(tasvir_area_desc)) % TASVIR_NR_AREAS;
+}
+/* snapshot slots that pin d */
+static inline uint32_t tasvir_snapshot_slots(const tasvir_area_desc *d) {
+    uint32_t slots = 0;
+    for (size_t i = 0; i < TASVIR_NR_SNAPSHOTS; i++)
+        slots |= (uint32_t)(atomic_load_explicit(&ttld.ndata->snapshots[i].d, memory_order_acquire) == d) << i;
+    return slots;
+}
+/* take the epoch lock of h_rw and return the hand-off state it guards in state */
+static inline bool tasvir_epoch_trylock(tasvir_area_header *h_rw, uint64_t *state) {
+    *state = __atomic_fetch_or(&h_rw->epoch_lock_, TASVIR_EPOCH_LOCKED, __ATOMIC_ACQUIRE);
+    return !(*state & TASVIR_EPOCH_LOCKED);
+}
+static inline void tasvir_epoch_unlock(tasvir_area_header *h_rw, uint64_t state) {
+    __atomic_store_n(&h_rw->epoch_lock_, state & ~TASVIR_EPOCH_LOCKED, __ATOMIC_RELEASE);
+}
+
+/* isa dispatch */
+
+#define TASVIR_ISA_TARGET_SSE4 __attribute__((target("sse4.2,popcnt")))
+#define TASVIR_ISA_TARGET_AVX2 __attribute__((target("avx2,bmi,lzcnt,popcnt")))
+#define TASVIR_ISA_TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx512vl,bmi,lzcnt,popcnt")))
+
+/* define fn to dispatch to copies of fn##_impl compiled for each instruction set; fn##_impl must be always_inline */
+#define TASVIR_ISA_DISPATCH(storage, ret_t, fn, params, args)                                  \
+    TASVIR_ISA_TARGET_SSE4 static ret_t fn##_sse4 params { return fn##_impl args; }           \
+    TASVIR_ISA_TARGET_AVX2 static ret_t fn##_avx2 params { return fn##_impl args; }           \
+    TASVIR_ISA_TARGET_AVX512 static ret_t fn##_avx512 params { return fn##_impl args; }       \
+    storage ret_t fn params {                                                                  \
+        static ret_t(*const fns[TASVIR_NR_ISA]) params = {fn##_sse4, fn##_avx2, fn##_avx512}; \
+        return fns[ttld.isa] args;                                                             \
+    }
+
+#define TASVIR_INLINE static inline __attribute__((always_inline))
+
+/* a log cacheline as a generic vector so that each dispatch variant picks its own instructions */
+typedef tasvir_log_t tasvir_log_vec __attribute__((vector_size(TASVIR_CACHELINE_BYTES)));
+
+TASVIR_INLINE bool tasvir_log_vec_is_zero(const tasvir_log_vec *v) {
+    tasvir_log_t r = 0;
+    for (size_t i = 0; i < sizeof(*v) / sizeof((*v)[0]); i++)
+        r |= (*v)[i];
+    return !r;
+}
+
+/* lzcnt and tzcnt semantics without requiring the instructions at compile time */
+TASVIR_INLINE int tasvir_clz64(uint64_t x) { return x ? __builtin_clzll(x) : 64; }
+TASVIR_INLINE int tasvir_ctz32(uint32_t x) { return x ? __builtin_ctz(x) : 32; }
+
+/* log summary */
+
+/* index of the first summary bit set in [idx, idx_end) or idx_end if none */
+static inline size_t tasvir_log_summary_next(const tasvir_log_t *__restrict summary, size_t idx, size_t idx_end) {
+    while (idx < idx_end) {
+        tasvir_log_t s = summary[idx / TASVIR_LOG_UNIT_BITS] << (idx % TASVIR_LOG_UNIT_BITS);
+        if (s) {
+            idx += tasvir_clz64(s);
+            return idx < idx_end ? idx : idx_end;
+        }
+        idx = (idx | (TASVIR_LOG_UNIT_BITS - 1)) + 1;
+    }
+    return idx_end;
+}
+
+/* clear summary bits idx0 to idx1 (inclusive); atomic because words may be shared with other areas */
+static inline void tasvir_log_summary_clear(tasvir_log_t *__restrict summary, size_t idx0, size_t idx1) {
+    size_t i0 = idx0 / TASVIR_LOG_UNIT_BITS;
+    size_t i1 = idx1 / TASVIR_LOG_UNIT_BITS;
+    for (size_t i = i0; i <= i1; i++) {
+        tasvir_log_t mask = ~(tasvir_log_t)0;
+        if (i == i0)
+            mask >>= idx0 % TASVIR_LOG_UNIT_BITS;
+        if (i == i1)
+            mask &= (1L << 63) >> (idx1 % TASVIR_LOG_UNIT_BITS);
+        if (summary[i] & mask)
+            __atomic_fetch_and(&summary[i], ~mask, __ATOMIC_RELAXED);
+    }
+}
 
 /* memory copy/strem */
 
@@ -108,10 +212,10 @@ static inline void *tasvir_data2rw(void *data) { return (uint8_t *)data + TASVIR
 #define TASVIR_VEC_BYTES 64
 #elif __AVX2__
 #define TASVIR_VEC_BYTES 32
-#elif __AVX__
+#elif __SSE4_1__
 #define TASVIR_VEC_BYTES 16
 #else
-#error AVX support required
+#error SSE4.1 support required
 #endif
 
 static inline void tasvir_memset_stream(void *dst, char c, size_t len) {
@@ -120,7 +224,7 @@ static inline void tasvir_memset_stream(void *dst, char c, size_t len) {
     __m512i m = _mm512_set1_epi8(c);
 #elif __AVX2__
     __m256i m = _mm256_set1_epi8(c);
-#elif __AVX__
+#else
     __m128i m = _mm_set1_epi8(c);
 #endif
     while ((uintptr_t)ptr & (TASVIR_VEC_BYTES - 1)) {
@@ -132,7 +236,7 @@ static inline void tasvir_memset_stream(void *dst, char c, size_t len) {
         _mm512_stream_si512((__m512i *)ptr, m);
 #elif __AVX2__
         _mm256_stream_si256((__m256i *)ptr, m);
-#elif __AVX__
+#else
         _mm_stream_si128((__m128i *)ptr, m);
 #endif
         ptr += TASVIR_VEC_BYTES;
@@ -149,7 +253,7 @@ static inline void tasvir_store_vec(void *__restrict dst, const void *__restrict
     _mm512_store_si512((__m512i *)dst, _mm512_load_si512((__m512i *)src));
 #elif __AVX2__
     _mm256_store_si256((__m256i *)dst, _mm256_load_si256((__m256i *)src));
-#elif __AVX__
+#else
     _mm_store_si128((__m128i *)dst, _mm_load_si128((__m128i *)src));
 #endif
     // _mm_cldemote(dst); // wish we had cldemote here :-)
@@ -162,7 +266,7 @@ static inline void tasvir_stream_vec(void *__restrict dst, const void *__restric
     _mm512_stream_si512((__m512i *)dst, _mm512_stream_load_si512((__m512i *)src));
 #elif __AVX2__
     _mm256_stream_si256((__m256i *)dst, _mm256_stream_load_si256((__m256i *)src));
-#elif __AVX__
+#else
     _mm_stream_si128((__m128i *)dst, _mm_stream_load_si128((__m128i *)src));
 #endif
 }
@@ -189,6 +293,82 @@ static inline void tasvir_stream_vec_rep(void *__restrict dst, const void *__res
     } while (dst < dst_end);
 }
 
+static inline void tasvir_prefetch_vec_rep(void *__restrict dst, const void *__restrict src, size_t len) {
+    dst = __builtin_assume_aligned(dst, TASVIR_VEC_BYTES);
+    src = __builtin_assume_aligned(src, TASVIR_VEC_BYTES);
+    void *dst_end = (void *)((uintptr_t)dst + len);
+    do {
+        _mm_prefetch((const uint8_t *)src + 8 * TASVIR_CACHELINE_BYTES, _MM_HINT_T0);
+        tasvir_store_vec(dst, src);
+        dst = (uint8_t *)dst + TASVIR_VEC_BYTES;
+        src = (uint8_t *)src + TASVIR_VEC_BYTES;
+    } while (dst < dst_end);
+}
+
+static inline void tasvir_movsb_rep(void *__restrict dst, const void *__restrict src, size_t len) {
+    __asm__ volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(len) : : "memory");
+}
+
+/* copy len bytes rounded up to whole vectors with kernel k */
+static inline void tasvir_copy_kernel_rep(tasvir_copy_kernel k, void *__restrict dst, const void *__restrict src,
+                                          size_t len) {
+    switch (k) {
+    case TASVIR_COPY_STREAM:
+        tasvir_stream_vec_rep(dst, src, len);
+        break;
+    case TASVIR_COPY_MOVSB:
+        tasvir_movsb_rep(dst, src, TASVIR_ALIGNX(len, TASVIR_VEC_BYTES));
+        break;
+    case TASVIR_COPY_PREFETCH:
+        tasvir_prefetch_vec_rep(dst, src, len);
+        break;
+    default:
+        tasvir_store_vec_rep(dst, src, len);
+    }
+}
+
+/* copy a run of changes with the kernel that has been cheapest for runs of its length on this thread.
+ * short runs are likely to be read again soon and always use temporal stores. longer runs time their copy, and one in
+ * TASVIR_COPY_EXPLORE of them tries another kernel so that the choice follows changes in cache residency.
+ */
+#define TASVIR_COPY_ADAPT_BYTES (1024)
+#define TASVIR_COPY_EXPLORE (64)
+static inline void tasvir_copy_vec_rep(void *__restrict dst, const void *__restrict src, size_t len) {
+    if (len < TASVIR_COPY_ADAPT_BYTES) {
+        tasvir_store_vec_rep(dst, src, len);
+        return;
+    }
+    int cls = 63 - tasvir_clz64(len / TASVIR_COPY_ADAPT_BYTES);
+    tasvir_copy_class *c = &ttld.copy_classes[cls < TASVIR_NR_COPY_CLASSES ? cls : TASVIR_NR_COPY_CLASSES - 1];
+    uint32_t n = c->nr_copies++;
+    tasvir_copy_kernel k = n % TASVIR_COPY_EXPLORE ? c->kernel : (n / TASVIR_COPY_EXPLORE) % TASVIR_NR_COPY;
+    if (n < TASVIR_NR_COPY)
+        k = n;
+    if (k == TASVIR_COPY_MOVSB && !ttld.has_erms)
+        k = c->kernel;
+
+    uint64_t tsc = __rdtsc();
+    tasvir_copy_kernel_rep(k, dst, src, len);
+    /* non-temporal and string stores are weakly ordered against the header update that publishes them.
+     * the fence drains them, so it is part of what the copy costs.
+     */
+    if (k == TASVIR_COPY_STREAM || k == TASVIR_COPY_MOVSB)
+        _mm_sfence();
+    uint32_t cost = ((__rdtsc() - tsc) << 10) / len + 1;
+    c->cycles_per_kb[k] = c->cycles_per_kb[k] ? (7 * c->cycles_per_kb[k] + cost) / 8 : cost;
+    for (int i = 0; i < TASVIR_NR_COPY; i++)
+        if (c->cycles_per_kb[i] && c->cycles_per_kb[i] < c->cycles_per_kb[c->kernel])
+            c->kernel = i;
+}
+
+/* copy ranges that are not vector aligned, e.g., of areas with a fine log granularity, with a plain memcpy */
+static inline void tasvir_stream_rep(void *__restrict dst, const void *__restrict src, size_t len) {
+    if (((uintptr_t)dst | (uintptr_t)src | len) & (TASVIR_VEC_BYTES - 1))
+        memcpy(dst, src, len);
+    else
+        tasvir_stream_vec_rep(dst, src, len);
+}
+
 /* thread */
 
 static inline bool tasvir_is_booting() { return !ttld.thread || (ttld.tdata->state == TASVIR_THREAD_STATE_BOOTING); }
@@ -200,6 +380,7 @@ static inline bool tasvir_is_running() { return ttld.thread && (ttld.tdata->stat
 static inline void tasvir_populate_msg_nethdr(tasvir_msg *m) {
     m->mbuf.refcnt = 1;
     m->mbuf.nb_segs = 1;
+    m->mbuf.next = NULL;
     memcpy(m->eh.ether_dhost, &m->dst_tid.nid.mac_addr, ETH_ALEN);
     memcpy(m->eh.ether_shost, &ttld.ndata->mac_addr, ETH_ALEN);
     m->eh.ether_type = rte_cpu_to_be_16(TASVIR_ETH_PROTO);
@@ -211,6 +392,7 @@ static inline void tasvir_populate_msg_nethdr(tasvir_msg *m) {
 
 /* formatting/printing */
 
+void tasvir_backtrace_handler(int sig); /* print a backtrace and exit; for SIGSEGV in the daemon and helpers */
 void tasvir_hexdump(void *addr, size_t len);
 void tasvir_area_str(const tasvir_area_desc *d, char *buf, size_t buf_size);
 void tasvir_msg_str(tasvir_msg *m, bool is_src_me, bool is_dst_me, char *buf, size_t buf_size);
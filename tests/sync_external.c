@@ -0,0 +1,188 @@
+/* unit tests of the zero-run encoding of memory messages and of the tracking of missing messages. the static
+ * functions under test are reached by including the file that defines them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../src/sync_external.c"
+
+static int nr_failures = 0;
+
+#define CHECK(cond)                                                           \
+    do {                                                                      \
+        if (!(cond)) {                                                        \
+            fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+            nr_failures++;                                                    \
+        }                                                                     \
+    } while (0)
+
+#define TEST_WORDS_MAX (TASVIR_ZRLE_GROUP_WORDS * 1024)
+
+static uint64_t src_buf[TEST_WORDS_MAX];
+static uint64_t dst_buf[TEST_WORDS_MAX];
+static uint8_t enc_buf[TEST_WORDS_MAX * sizeof(uint64_t) * 2];
+
+/* nonzero words with probability pct/100 */
+static void fill(uint64_t *buf, size_t nr_words, int pct) {
+    for (size_t i = 0; i < nr_words; i++)
+        buf[i] = rand() % 100 < pct ? (uint64_t)rand() << 32 | (uint32_t)rand() | 1 : 0;
+}
+
+/* encode nr_words of src_buf with no cap and check they decode to the same words */
+static size_t roundtrip(size_t nr_words) {
+    size_t len = nr_words * sizeof(uint64_t);
+    size_t enc_len;
+    CHECK(tasvir_zrle_encode(enc_buf, sizeof(enc_buf), src_buf, len, &enc_len) == len);
+    memset(dst_buf, 0xff, sizeof(dst_buf));
+    CHECK(tasvir_zrle_decode(dst_buf, len, enc_buf, enc_len));
+    CHECK(!memcmp(dst_buf, src_buf, len));
+    /* words past len stay untouched */
+    CHECK(nr_words == TEST_WORDS_MAX || dst_buf[nr_words] == ~0UL);
+    return enc_len;
+}
+
+static void test_zrle_roundtrip() {
+    const int pcts[] = {0, 1, 10, 50, 100};
+    for (size_t p = 0; p < sizeof(pcts) / sizeof(pcts[0]); p++) {
+        /* whole groups and a trailing partial group of every size */
+        for (size_t nr_words = 1; nr_words <= 5 * TASVIR_ZRLE_GROUP_WORDS; nr_words++) {
+            fill(src_buf, nr_words, pcts[p]);
+            roundtrip(nr_words);
+        }
+        fill(src_buf, TEST_WORDS_MAX, pcts[p]);
+        roundtrip(TEST_WORDS_MAX);
+    }
+}
+
+static void test_zrle_run_cap() {
+    /* runs longer than 255 groups are split and a run may end in a partial group */
+    const size_t nr_groups[] = {254, 255, 256, 510, 511, 600};
+    for (size_t i = 0; i < sizeof(nr_groups) / sizeof(nr_groups[0]); i++) {
+        for (size_t extra = 0; extra < TASVIR_ZRLE_GROUP_WORDS; extra++) {
+            size_t nr_words = nr_groups[i] * TASVIR_ZRLE_GROUP_WORDS + extra;
+            memset(src_buf, 0, nr_words * sizeof(uint64_t));
+            size_t nr_runs = (nr_groups[i] + (extra > 0) + UINT8_MAX - 1) / UINT8_MAX;
+            CHECK(roundtrip(nr_words) == 2 * nr_runs);
+            /* a nonzero word right after the run */
+            src_buf[nr_words] = 42;
+            roundtrip(nr_words + 1);
+            src_buf[nr_words] = 0;
+        }
+    }
+}
+
+static void test_zrle_cap() {
+    fill(src_buf, TEST_WORDS_MAX, 30);
+    size_t len = TEST_WORDS_MAX * sizeof(uint64_t);
+    for (size_t cap = 0; cap < 4096; cap += cap < 64 ? 1 : 37) {
+        size_t enc_len;
+        size_t done = tasvir_zrle_encode(enc_buf, cap, src_buf, len, &enc_len);
+        CHECK(enc_len <= cap);
+        CHECK(done % sizeof(uint64_t) == 0 && done <= len);
+        memset(dst_buf, 0xff, sizeof(dst_buf));
+        CHECK(tasvir_zrle_decode(dst_buf, done, enc_buf, enc_len));
+        CHECK(!memcmp(dst_buf, src_buf, done));
+        /* the rest continues where the cut was made */
+        size_t rest_len;
+        CHECK(tasvir_zrle_encode(enc_buf, sizeof(enc_buf), &src_buf[done / sizeof(uint64_t)], len - done,
+                                 &rest_len) == len - done);
+        CHECK(tasvir_zrle_decode(&dst_buf[done / sizeof(uint64_t)], len - done, enc_buf, rest_len));
+        CHECK(!memcmp(dst_buf, src_buf, len));
+    }
+}
+
+static void test_zrle_truncated() {
+    /* place the encoding right before a page that faults on access so that reading past its end crashes */
+    long page = sysconf(_SC_PAGESIZE);
+    uint8_t *guard = mmap(NULL, 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CHECK(guard != MAP_FAILED);
+    if (guard == MAP_FAILED)
+        return;
+    CHECK(!mprotect(guard + page, page, PROT_NONE));
+
+    const int pcts[] = {0, 20, 100};
+    for (size_t p = 0; p < sizeof(pcts) / sizeof(pcts[0]); p++) {
+        size_t nr_words = 3 * TASVIR_ZRLE_GROUP_WORDS + 3;
+        size_t len = nr_words * sizeof(uint64_t);
+        fill(src_buf, nr_words, pcts[p]);
+        size_t enc_len;
+        tasvir_zrle_encode(enc_buf, sizeof(enc_buf), src_buf, len, &enc_len);
+        CHECK(enc_len <= (size_t)page);
+        for (size_t cut = 0; cut < enc_len; cut++) {
+            uint8_t *enc = guard + page - cut;
+            memcpy(enc, enc_buf, cut);
+            CHECK(!tasvir_zrle_decode(dst_buf, len, enc, cut));
+        }
+    }
+    munmap(guard, 2 * page);
+}
+
+static const tasvir_area_desc desc_a, desc_b;
+
+static void test_gap_fill() {
+    tasvir_ext_gap *g = tasvir_ext_gap_new(&desc_a, 1, 10, 20);
+    CHECK(g && ttld.ndata->nr_ext_gaps == 1);
+    CHECK(!tasvir_ext_gap_fill(&desc_b, 15));
+    CHECK(!tasvir_ext_gap_fill(&desc_a, 9));
+    CHECK(!tasvir_ext_gap_fill(&desc_a, 20));
+
+    /* the ends shrink the gap */
+    CHECK(tasvir_ext_gap_fill(&desc_a, 10));
+    CHECK(g->seq_start == 11 && g->seq_end == 20);
+    CHECK(tasvir_ext_gap_fill(&desc_a, 19));
+    CHECK(g->seq_start == 11 && g->seq_end == 19);
+    CHECK(!tasvir_ext_gap_fill(&desc_a, 19));
+
+    /* the middle splits it in two */
+    CHECK(tasvir_ext_gap_fill(&desc_a, 15));
+    CHECK(ttld.ndata->nr_ext_gaps == 2);
+    CHECK(g->seq_start == 11 && g->seq_end == 15);
+    CHECK(!tasvir_ext_gap_fill(&desc_a, 15));
+    for (uint32_t seq = 11; seq < 19; seq++)
+        CHECK(tasvir_ext_gap_fill(&desc_a, seq) == (seq != 15));
+    CHECK(ttld.ndata->nr_ext_gaps == 0 && !tasvir_ext_gap_find(&desc_a));
+}
+
+static void test_gap_full() {
+    for (uint32_t i = 0; i < TASVIR_NR_EXT_GAPS; i++)
+        CHECK(tasvir_ext_gap_new(&desc_a, 1, 10 * i, 10 * i + 5));
+    CHECK(!tasvir_ext_gap_new(&desc_b, 1, 0, 1));
+
+    /* with no room to split, the middle arrives without changing the gap */
+    CHECK(tasvir_ext_gap_fill(&desc_a, 2));
+    CHECK(ttld.ndata->nr_ext_gaps == TASVIR_NR_EXT_GAPS);
+    CHECK(ttld.ndata->ext_gaps[0].seq_start == 0 && ttld.ndata->ext_gaps[0].seq_end == 5);
+
+    /* a gap that fills up frees its slot for the next one */
+    for (uint32_t seq = 10; seq < 15; seq++)
+        CHECK(tasvir_ext_gap_fill(&desc_a, seq));
+    CHECK(ttld.ndata->nr_ext_gaps == TASVIR_NR_EXT_GAPS - 1);
+    CHECK(tasvir_ext_gap_new(&desc_b, 1, 0, 1) == &ttld.ndata->ext_gaps[1]);
+
+    tasvir_ext_gap_drop(&desc_a);
+    tasvir_ext_gap_drop(&desc_b);
+    CHECK(ttld.ndata->nr_ext_gaps == 0);
+}
+
+int main() {
+    size_t ndata_bytes = TASVIR_ALIGNX(sizeof(tasvir_local_ndata), TASVIR_PAGE_BYTES);
+    ttld.ndata = aligned_alloc(TASVIR_PAGE_BYTES, ndata_bytes);
+    if (!ttld.ndata)
+        return 1;
+    memset(ttld.ndata, 0, ndata_bytes);
+    srand(1);
+
+    test_zrle_roundtrip();
+    test_zrle_run_cap();
+    test_zrle_cap();
+    test_zrle_truncated();
+    test_gap_fill();
+    test_gap_full();
+
+    free(ttld.ndata);
+    if (nr_failures)
+        fprintf(stderr, "%d checks failed\n", nr_failures);
+    return nr_failures ? 1 : 0;
+}